@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/Tokenization.cpp"
+#include "../src/Parser.cpp"
+#include "../src/IR.cpp"
+#include "../src/Generation.cpp"
+#include "ProgramGenerator.cpp"
+
+// Front-end throughput benchmarks.
+//
+// helium_bench [--sizes=1K,32K,...] [--max-size=SIZE] [--min-time=SECONDS] [--jobs=N] [shape options]
+//     Runs Tokenizer::tokenize, Parser::parseProgram and Generator::generateProgram on generated
+//     programs of every size and prints MB/s, tokens/s, nodes/s and the peak RSS of each size.
+//     --jobs=N adds rows for tokenizing and generating on N threads.
+// helium_bench generate [--size=SIZE | --statements=N] [shape options]
+//     Writes one generated program to stdout.
+//
+// Shape options: --seed=N --depth=N --multiply=PERCENT --identifier-share=PERCENT
+//                --identifiers=N --identifier-length=N
+
+struct Measurement {
+    // Best time of one run, in seconds.
+    double seconds;
+    size_t runs;
+};
+
+// Repeats `body` until `minTime` seconds have passed, at least once, and keeps the fastest run.
+// `prepare` runs before every repetition, outside the timed part.
+template<typename Prepare, typename Body> Measurement measure(double minTime, Prepare&& prepare, Body&& body) {
+    Measurement result {.seconds = 1e300, .runs = 0};
+    double elapsed = 0;
+    while (result.runs == 0 || elapsed < minTime) {
+        prepare();
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.seconds = std::min(result.seconds, seconds);
+        result.runs++;
+        elapsed += seconds;
+    }
+    return result;
+}
+
+static bool parseSize(const std::string& text, size_t& size) {
+    char* end = nullptr;
+    unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    std::string suffix = end;
+    if (suffix == "K" || suffix == "k") {
+        value <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        value <<= 20;
+    } else if (suffix == "G" || suffix == "g") {
+        value <<= 30;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    size = value;
+    return true;
+}
+
+static std::string formatSize(size_t size) {
+    const char* units[] = {"B", "KiB", "MiB", "GiB"};
+    int unit = 0;
+    while (unit < 3 && size >= 1024 && size % 1024 == 0) {
+        size /= 1024;
+        unit++;
+    }
+    return std::to_string(size) + " " + units[unit];
+}
+
+static void printRow(const std::string& size, const std::string& phase, size_t bytes, size_t tokens, size_t nodes, const Measurement& measurement) {
+    double seconds = measurement.seconds;
+    char nodeRate[32] = "-";
+    if (nodes != 0) {
+        std::snprintf(nodeRate, sizeof(nodeRate), "%.2f", static_cast<double>(nodes) / seconds / 1e6);
+    }
+    std::printf("%10s  %-11s %10.3f ms %6zu runs %10.1f MB/s %10.2f Mtok/s %10s Mnode/s\n",
+                size.c_str(), phase.c_str(), seconds * 1000, measurement.runs,
+                static_cast<double>(bytes) / seconds / 1e6, static_cast<double>(tokens) / seconds / 1e6, nodeRate);
+}
+
+// Benchmarks one input size. Runs in its own process so the reported peak RSS belongs to it alone.
+static void benchmarkSize(ProgramShape shape, size_t size, double minTime, size_t jobs) {
+    shape.targetBytes = size;
+    std::string source = ProgramGenerator(shape).generateProgram();
+    std::string label = formatSize(size);
+
+    std::vector<Token> tokens;
+    Measurement tokenizing = measure(minTime, [&] { tokens = {}; }, [&] {
+        Tokenizer tokenizer(source);
+        tokens = tokenizer.tokenize();
+    });
+    size_t tokenCount = tokens.size();
+    printRow(label, "tokenize", source.size(), tokenCount, 0, tokenizing);
+    std::optional<ThreadPool> pool;
+    if (jobs > 1) {
+        pool.emplace(jobs);
+        Measurement parallel = measure(minTime, [&] { tokens = {}; }, [&] {
+            Tokenizer tokenizer(source);
+            tokens = tokenizer.tokenize(pool.value());
+        });
+        printRow(label, "tokenize/" + std::to_string(jobs), source.size(), tokenCount, 0, parallel);
+    }
+
+    std::optional<NodeProgram> root;
+    std::optional<Parser> parser;
+    Measurement parsing = measure(minTime, [&] {
+        root.reset();
+        parser.reset();
+        parser.emplace(tokens, source);
+    }, [&] {
+        root = parser->parseProgram();
+    });
+    parser.reset();
+    tokens = {};
+    size_t nodeCount = root->nodeCount();
+    printRow(label, "parse", source.size(), tokenCount, nodeCount, parsing);
+
+    // Unoptimized IR, so the generator sees every node instead of one folded constant.
+    IRModule module;
+    IRLowering lowering(module, root.value());
+    lowering.lowerProgram();
+    MachineProgram program;
+    Measurement generating = measure(minTime, [&] { program = {}; }, [&] {
+        Generator generator(module, "Linux");
+        program = generator.generateProgram();
+    });
+    printRow(label, "generate", source.size(), tokenCount, nodeCount, generating);
+    if (pool.has_value()) {
+        Measurement parallel = measure(minTime, [&] { program = {}; }, [&] {
+            Generator generator(module, "Linux");
+            program = generator.generateProgram(pool.value());
+        });
+        printRow(label, "generate/" + std::to_string(jobs), source.size(), tokenCount, nodeCount, parallel);
+    }
+
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    std::printf("%10s  peak RSS %.1f MiB, %zu tokens, %zu nodes, %zu instructions\n",
+                label.c_str(), static_cast<double>(usage.ru_maxrss) / 1024, tokenCount, nodeCount, program.insts.size());
+}
+
+int main(int argc, char* argv[]) {
+    ProgramShape shape;
+    std::vector<size_t> sizes = {1ull << 10, 32ull << 10, 1ull << 20, 32ull << 20, 1ull << 30};
+    size_t maxSize = SIZE_MAX;
+    size_t programSize = 0;
+    double minTime = 0.5;
+    size_t jobs = 1;
+    bool generate = argc > 1 && std::string(argv[1]) == "generate";
+    for (int i = generate ? 2 : 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value = arg.substr(arg.find('=') + 1);
+        bool valid = true;
+        if (arg.starts_with("--seed=")) {
+            shape.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--depth=")) {
+            shape.depth = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--multiply=")) {
+            shape.multiplyPercent = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--identifier-share=")) {
+            shape.identifierPercent = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--identifiers=")) {
+            shape.identifiers = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--identifier-length=")) {
+            shape.identifierLength = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (generate && arg.starts_with("--statements=")) {
+            shape.statements = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (generate && arg.starts_with("--size=")) {
+            valid = parseSize(value, programSize);
+        } else if (!generate && arg.starts_with("--sizes=")) {
+            sizes.clear();
+            size_t start = 0;
+            while (valid && start <= value.size()) {
+                size_t comma = std::min(value.find(',', start), value.size());
+                size_t size = 0;
+                valid = parseSize(value.substr(start, comma - start), size);
+                sizes.push_back(size);
+                start = comma + 1;
+            }
+        } else if (!generate && arg.starts_with("--max-size=")) {
+            valid = parseSize(value, maxSize);
+        } else if (!generate && arg.starts_with("--min-time=")) {
+            minTime = std::strtod(value.c_str(), nullptr);
+        } else if (!generate && arg.starts_with("--jobs=")) {
+            jobs = std::strtoul(value.c_str(), nullptr, 10);
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            std::cerr << "Unknown or malformed option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (generate) {
+        shape.targetBytes = programSize;
+        std::string program = ProgramGenerator(shape).generateProgram();
+        std::fwrite(program.data(), 1, program.size(), stdout);
+        return EXIT_SUCCESS;
+    }
+
+    int status = EXIT_SUCCESS;
+    for (size_t size: sizes) {
+        if (size > maxSize) {
+            continue;
+        }
+        std::fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) {
+            try {
+                benchmarkSize(shape, size, minTime, jobs);
+            } catch (const std::exception& exception) {
+                std::cerr << formatSize(size) << ": " << exception.what() << std::endl;
+                std::fflush(stdout);
+                _exit(EXIT_FAILURE);
+            }
+            std::fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+        int childStatus = 0;
+        if (child < 0 || waitpid(child, &childStatus, 0) < 0) {
+            std::perror("fork");
+            return EXIT_FAILURE;
+        }
+        if (WIFSIGNALED(childStatus)) {
+            std::cerr << formatSize(size) << ": killed by signal " << WTERMSIG(childStatus) << ", most likely out of memory" << std::endl;
+        }
+        if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != EXIT_SUCCESS) {
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
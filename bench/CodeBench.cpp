@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../src/Source.cpp"
+#include "../src/Tokenization.cpp"
+#include "../src/Parser.cpp"
+#include "../src/Pipeline.cpp"
+#include "../src/Encoding.cpp"
+#include "../src/Elf.cpp"
+#include "../src/Jit.cpp"
+#include "../src/Bytecode.cpp"
+#include "../src/Interpreter.cpp"
+#include "../src/Streaming.cpp"
+#include "ProgramGenerator.cpp"
+
+// Generated code benchmarks.
+//
+// helium_codebench [--corpus=FILE,...] [--statements=N,...] [--runs=N] [--work-dir=DIR]
+//                  [--out=FILE] [--baseline=FILE] [shape options]
+//     Compiles every corpus file, test.he by default, and a generated program of every statement
+//     count with each backend at -O0 and -O1. Records the static instruction count, the pushes and
+//     pops among them, the binary size and the best runtime of the output over --runs runs, and
+//     checks the result against the interpreter. Writes JSON to --out, or stdout, one result per
+//     line. --baseline=FILE compares with an earlier output and reports every result that takes
+//     more instructions, pushes, pops or bytes, or that was right before and is wrong now. Exits
+//     with failure on a wrong result or a regression.
+//
+// Backends: exe, the executable of the default pipeline, and stream, the one of --stream, both run
+// as a process, so their runtime includes starting it and their result is the exit code; jit, the
+// default pipeline's code called in-process, whose result is the whole 64 bit value and whose
+// binary size is its code. asm is left out, being the exe's instructions handed to nasm.
+//
+// Shape options: --seed=N --depth=N --multiply=PERCENT --identifier-share=PERCENT --identifiers=N
+
+struct BenchProgram {
+    std::string name;
+    std::string source;
+    uint64_t expected = 0;
+};
+
+struct Result {
+    std::string program;
+    std::string backend;
+    int level = 0;
+    uint64_t instructions = 0;
+    uint64_t pushPops = 0;
+    uint64_t binaryBytes = 0;
+    // Best time of one run, in seconds.
+    double seconds = 0;
+    size_t runs = 0;
+    uint64_t value = 0;
+    uint64_t expected = 0;
+    std::string error {};
+
+    [[nodiscard]] bool correct() const {
+        return error.empty() && value == expected;
+    }
+};
+
+static NodeProgram parseSource(std::string_view source) {
+    Tokenizer tokenizer(source);
+    Parser parser(tokenizer.tokenize(), source);
+    std::optional<NodeProgram> root = parser.parseProgram();
+    if (!root.has_value()) {
+        throw CompileError("No exit node found!");
+    }
+    return std::move(root.value());
+}
+
+// The reference result: the interpreter on the unoptimized program.
+static uint64_t interpret(std::string_view source) {
+    NodeProgram root = parseSource(source);
+    BytecodeCompiler compiler(root);
+    BytecodeProgram bytecode = compiler.compileProgram();
+    Interpreter interpreter(bytecode);
+    return interpreter.run();
+}
+
+// The default pipeline at `level`, as helium and JitCompiler run it, generating an entry point or,
+// for the JIT, a function. Counts the instructions into `result` and returns the encoded code.
+static std::vector<uint8_t> compileSource(std::string_view source, int level, bool function, Result& result) {
+    NodeProgram root = parseSource(source);
+    MachineProgram program = CompilePipeline(level, PeepholeOptions {}).compile(root, function ? std::nullopt : std::optional<std::string>("Linux"));
+    result.instructions = program.insts.size();
+    for (const MInst& inst: program.insts) {
+        result.pushPops += inst.op == MOp::push || inst.op == MOp::pop;
+    }
+    X86Encoder encoder;
+    return encoder.encodeProgram(program);
+}
+
+// Runs `run` `runs` times, keeping the fastest time and the last value it returns.
+template<typename Run> static void measure(size_t runs, Result& result, Run&& run) {
+    result.seconds = 1e300;
+    for (result.runs = 0; result.runs < runs; ++result.runs) {
+        auto start = std::chrono::steady_clock::now();
+        result.value = run();
+        result.seconds = std::min(result.seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+}
+
+// The exit code of the executable at `path`, or 128 plus the signal that killed it.
+static uint64_t runExecutable(const std::string& path) {
+    pid_t child = fork();
+    if (child == 0) {
+        execl(path.c_str(), path.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) < 0) {
+        throw CompileError("Unable to run " + path);
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static void benchmarkExe(const BenchProgram& program, const std::string& workDir, size_t runs, Result& result) {
+    std::string path = workDir + "/out";
+    std::vector<uint8_t> code = compileSource(program.source, result.level, false, result);
+    ElfWriter(code).writeExecutable(path);
+    result.binaryBytes = std::filesystem::file_size(path);
+    result.expected &= 0xFF;
+    measure(runs, result, [&] {
+        return runExecutable(path);
+    });
+}
+
+static void benchmarkJit(const BenchProgram& program, size_t runs, Result& result) {
+    std::vector<uint8_t> code = compileSource(program.source, result.level, true, result);
+    result.binaryBytes = code.size();
+    JitFunction function(code);
+    measure(runs, result, [&] {
+        return function.run();
+    });
+}
+
+static void benchmarkStream(const BenchProgram& program, const std::string& workDir, size_t runs, Result& result) {
+    std::string sourcePath = workDir + "/source.he";
+    std::string path = workDir + "/out";
+    {
+        std::ofstream file(sourcePath, std::ios::binary);
+        file << program.source;
+        if (!file) {
+            throw CompileError("Unable to write " + sourcePath);
+        }
+    }
+    int input = ::open(sourcePath.c_str(), O_RDONLY);
+    if (input < 0) {
+        throw CompileError("Unable to open " + sourcePath);
+    }
+    StreamingCompiler compiler("Linux", "exe", result.level, PeepholeOptions {});
+    try {
+        compiler.compile(input, path, ElfWriter::osAbiSysV);
+    } catch (...) {
+        close(input);
+        throw;
+    }
+    close(input);
+    result.instructions = compiler.instructionCount();
+    result.pushPops = compiler.pushPopCount();
+    result.binaryBytes = compiler.outputBytes();
+    result.expected &= 0xFF;
+    measure(runs, result, [&] {
+        return runExecutable(path);
+    });
+}
+
+static std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c: text) {
+        if (c == '"' || c == '\\') {
+            quoted.push_back('\\');
+            quoted.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof(escape), "\\u%04x", c);
+            quoted.append(escape);
+        } else {
+            quoted.push_back(c);
+        }
+    }
+    return quoted + "\"";
+}
+
+static std::string formatResult(const Result& result) {
+    char seconds[32];
+    std::snprintf(seconds, sizeof(seconds), "%.9f", result.seconds);
+    std::string line = "{\"program\": " + jsonString(result.program) + ", \"backend\": " + jsonString(result.backend) +
+                       ", \"level\": " + std::to_string(result.level) +
+                       ", \"instructions\": " + std::to_string(result.instructions) +
+                       ", \"pushPops\": " + std::to_string(result.pushPops) +
+                       ", \"binaryBytes\": " + std::to_string(result.binaryBytes) +
+                       ", \"seconds\": " + seconds + ", \"runs\": " + std::to_string(result.runs) +
+                       ", \"result\": " + std::to_string(result.value) + ", \"expected\": " + std::to_string(result.expected) +
+                       ", \"correct\": " + (result.correct() ? "true" : "false");
+    if (!result.error.empty()) {
+        line.append(", \"error\": ").append(jsonString(result.error));
+    }
+    return line + "}";
+}
+
+// The value of `key` on a result line as formatResult writes it, strings still quoted and escaped.
+static std::string field(const std::string& line, const std::string& key) {
+    std::string label = "\"" + key + "\": ";
+    size_t start = line.find(label);
+    if (start == std::string::npos) {
+        return {};
+    }
+    start += label.size();
+    size_t end = start;
+    if (line[start] == '"') {
+        for (end = start + 1; end < line.size() && line[end] != '"'; ++end) {
+            end += line[end] == '\\';
+        }
+        return line.substr(start, end + 1 - start);
+    }
+    end = line.find_first_of(",}", start);
+    return line.substr(start, end - start);
+}
+
+[[nodiscard]] static std::string resultKey(const std::string& line) {
+    return field(line, "program") + " " + field(line, "backend") + " -O" + field(line, "level");
+}
+
+// Reports every result that got bigger or went wrong since the baseline. Runtime is left to the
+// reader, being too noisy to flag on one run.
+static bool compareBaseline(const std::vector<std::string>& lines, const std::string& baselinePath) {
+    std::ifstream baseline(baselinePath);
+    if (!baseline) {
+        throw CompileError("Unable to open " + baselinePath);
+    }
+    std::vector<std::string> earlier;
+    for (std::string line; std::getline(baseline, line);) {
+        if (line.find("\"program\": ") != std::string::npos) {
+            earlier.push_back(line);
+        }
+    }
+    bool regressed = false;
+    for (const std::string& line: lines) {
+        auto before = std::find_if(earlier.begin(), earlier.end(), [&](const std::string& candidate) {
+            return resultKey(candidate) == resultKey(line);
+        });
+        if (before == earlier.end()) {
+            continue;
+        }
+        for (const char* metric: {"instructions", "pushPops", "binaryBytes"}) {
+            uint64_t was = std::strtoull(field(*before, metric).c_str(), nullptr, 10);
+            uint64_t now = std::strtoull(field(line, metric).c_str(), nullptr, 10);
+            if (now > was) {
+                std::cerr << resultKey(line) << ": " << metric << " " << was << " -> " << now << std::endl;
+                regressed = true;
+            }
+        }
+        if (field(*before, "correct") == "true" && field(line, "correct") != "true") {
+            std::cerr << resultKey(line) << ": was correct, now wrong" << std::endl;
+            regressed = true;
+        }
+    }
+    return !regressed;
+}
+
+static std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = std::min(text.find(',', start), text.size());
+        if (comma > start) {
+            items.push_back(text.substr(start, comma - start));
+        }
+        start = comma + 1;
+    }
+    return items;
+}
+
+int main(int argc, char* argv[]) {
+    ProgramShape shape;
+    std::vector<std::string> corpus = {"test.he"};
+    std::vector<size_t> statementCounts = {1000, 100000};
+    size_t runs = 5;
+    std::string workDir;
+    std::string outPath;
+    std::string baselinePath;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value = arg.substr(arg.find('=') + 1);
+        if (arg.starts_with("--corpus=")) {
+            corpus = splitList(value);
+        } else if (arg.starts_with("--statements=")) {
+            statementCounts.clear();
+            for (const std::string& count: splitList(value)) {
+                statementCounts.push_back(std::strtoull(count.c_str(), nullptr, 10));
+            }
+        } else if (arg.starts_with("--runs=")) {
+            runs = std::max<size_t>(std::strtoul(value.c_str(), nullptr, 10), 1);
+        } else if (arg.starts_with("--work-dir=")) {
+            workDir = value;
+        } else if (arg.starts_with("--out=")) {
+            outPath = value;
+        } else if (arg.starts_with("--baseline=")) {
+            baselinePath = value;
+        } else if (arg.starts_with("--seed=")) {
+            shape.seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--depth=")) {
+            shape.depth = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--multiply=")) {
+            shape.multiplyPercent = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--identifier-share=")) {
+            shape.identifierPercent = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (arg.starts_with("--identifiers=")) {
+            shape.identifiers = std::strtoull(value.c_str(), nullptr, 10);
+        } else {
+            std::cerr << "Unknown or malformed option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    bool ownWorkDir = workDir.empty();
+    try {
+        std::vector<BenchProgram> programs;
+        for (const std::string& path: corpus) {
+            programs.push_back({.name = path, .source = std::string(SourceBuffer::open(path).view())});
+        }
+        for (size_t count: statementCounts) {
+            shape.statements = count;
+            programs.push_back({.name = "generated-" + std::to_string(count), .source = ProgramGenerator(shape).generateProgram()});
+        }
+        for (BenchProgram& program: programs) {
+            program.expected = interpret(program.source);
+        }
+        if (ownWorkDir) {
+            char pattern[] = "/tmp/helium-codebench-XXXXXX";
+            if (mkdtemp(pattern) == nullptr) {
+                throw CompileError("Unable to create a work directory");
+            }
+            workDir = pattern;
+        } else {
+            // A work directory that cannot be written would show up as wrong results instead.
+            std::error_code failure;
+            std::filesystem::create_directories(workDir, failure);
+            if (failure || access(workDir.c_str(), W_OK | X_OK) != 0) {
+                throw CompileError("Unable to use work directory " + workDir);
+            }
+        }
+
+        std::vector<std::string> lines;
+        bool allCorrect = true;
+        for (const BenchProgram& program: programs) {
+            for (int level: {0, 1}) {
+                for (const char* backend: {"exe", "jit", "stream"}) {
+                    Result result {.program = program.name, .backend = backend, .level = level, .expected = program.expected};
+                    try {
+                        if (result.backend == "exe") {
+                            benchmarkExe(program, workDir, runs, result);
+                        } else if (result.backend == "jit") {
+                            benchmarkJit(program, runs, result);
+                        } else {
+                            benchmarkStream(program, workDir, runs, result);
+                        }
+                    } catch (const std::exception& exception) {
+                        result.error = exception.what();
+                    }
+                    lines.push_back(formatResult(result));
+                    if (!result.correct()) {
+                        std::cerr << resultKey(lines.back()) << ": wrong, " << lines.back() << std::endl;
+                        allCorrect = false;
+                    }
+                }
+            }
+        }
+
+        std::ofstream file;
+        if (!outPath.empty()) {
+            file.open(outPath);
+            if (!file) {
+                throw CompileError("Unable to write " + outPath);
+            }
+        }
+        std::ostream& out = outPath.empty() ? std::cout : file;
+        out << "{\"results\": [\n";
+        for (size_t i = 0; i < lines.size(); ++i) {
+            out << lines[i] << (i + 1 < lines.size() ? ",\n" : "\n");
+        }
+        out << "]}" << std::endl;
+
+        if (ownWorkDir) {
+            unlink((workDir + "/out").c_str());
+            unlink((workDir + "/source.he").c_str());
+            rmdir(workDir.c_str());
+        }
+        bool unchanged = baselinePath.empty() || compareBaseline(lines, baselinePath);
+        return allCorrect && unchanged ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (const std::exception& exception) {
+        std::cerr << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
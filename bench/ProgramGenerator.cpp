@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct ProgramShape {
+    uint64_t seed = 1;
+    // `var` statements before the final exit; ignored when targetBytes is set.
+    size_t statements = 1000;
+    // Stops adding statements once the program is at least this long. Zero to use `statements`.
+    size_t targetBytes = 0;
+    // Binary operators per expression.
+    unsigned depth = 4;
+    // Share of the operators that are `*`, the rest are `+`.
+    unsigned multiplyPercent = 30;
+    // Share of the operands that name an earlier variable, the rest are literals.
+    unsigned identifierPercent = 50;
+    // Operands draw from this many of the most recently declared variables.
+    size_t identifiers = 64;
+    // Length of every variable name; raised to fit the statement index where needed.
+    unsigned identifierLength = 8;
+};
+
+// Writes Helium programs for benchmarks. The same shape always gives the same bytes, on every
+// platform: the generator keeps its own random number generator rather than relying on <random>'s
+// distributions. Every program is valid and ends with an exit of the last variable.
+class ProgramGenerator {
+    public:
+        inline explicit ProgramGenerator(ProgramShape pShape): shape(pShape), state(pShape.seed) {
+        }
+
+        [[nodiscard]] std::string generateProgram() {
+            std::string text;
+            text.reserve(shape.targetBytes + 256);
+            size_t index = 0;
+            while (shape.targetBytes != 0 ? text.size() < shape.targetBytes : index < shape.statements) {
+                text.append("var ");
+                appendName(text, index);
+                text.append(" = ");
+                appendOperand(text, index);
+                for (unsigned i = 0; i < shape.depth; ++i) {
+                    text.append(next() % 100 < shape.multiplyPercent ? " * " : " + ");
+                    appendOperand(text, index);
+                }
+                text.append(";\n");
+                index++;
+            }
+            text.append("exit(");
+            if (index == 0) {
+                text.append("0");
+            } else {
+                appendName(text, index - 1);
+            }
+            text.append(");\n");
+            return text;
+        }
+
+    private:
+        // splitmix64
+        uint64_t next() {
+            uint64_t z = state += 0x9E3779B97F4A7C15ull;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+            return z ^ (z >> 31);
+        }
+
+        // Letters, then the decimal index, so names never collide with each other or a keyword.
+        void appendName(std::string& text, size_t index) const {
+            std::string digits = std::to_string(index);
+            size_t padding = shape.identifierLength > digits.size() ? shape.identifierLength - digits.size() : 1;
+            text.append(padding, 'v');
+            text.append(digits);
+        }
+
+        // An earlier variable or a literal of 1 to 9 digits; `declared` variables exist so far.
+        void appendOperand(std::string& text, size_t declared) {
+            if (declared > 0 && shape.identifiers > 0 && next() % 100 < shape.identifierPercent) {
+                size_t window = declared < shape.identifiers ? declared : shape.identifiers;
+                appendName(text, declared - 1 - next() % window);
+            } else {
+                static constexpr uint64_t limits[9] = {10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+                text.append(std::to_string(next() % limits[next() % 9]));
+            }
+        }
+
+        ProgramShape shape;
+        uint64_t state;
+};
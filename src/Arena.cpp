@@ -1,31 +1,164 @@
 #pragma once
 
-#include "iostream"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+// Bump allocator made of a chain of chunks. The first chunk is small and every chunk after it is
+// twice as large as the one before, so tiny inputs stay cheap and huge inputs never overflow.
 class ArenaAllocator {
     public:
 
-        inline explicit ArenaAllocator(size_t bytes): size(bytes) {
-            buffer = static_cast<std::byte *>(malloc(size));
-            offset = buffer;
+        // Position in the arena that can be handed back to rewind() to free everything allocated after it.
+        struct Mark {
+            size_t chunkIndex;
+            std::byte* offset;
+            size_t used;
+            size_t finalizerCount;
+        };
+
+        struct Stats {
+            size_t bytesUsed;
+            size_t peakBytesUsed;
+            size_t bytesReserved;
+            size_t chunkCount;
+        };
+
+        static constexpr size_t defaultInitialSize = 64 * 1024;
+
+        inline explicit ArenaAllocator(size_t initialBytes = defaultInitialSize) {
+            addChunk(initialBytes == 0 ? defaultInitialSize : initialBytes);
+        }
+
+        template<typename T, typename... Args> inline T* alloc(Args&&... args) {
+            void* memory = allocBytes(sizeof(T), alignof(T));
+            T* object = new (memory) T(std::forward<Args>(args)...);
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                addFinalizer(object, [](void* ptr) { static_cast<T*>(ptr)->~T(); });
+            }
+            return object;
+        }
+
+        inline void* allocBytes(size_t bytes, size_t alignment = alignof(std::max_align_t)) {
+            std::byte* aligned = alignUp(offset, alignment);
+            if (aligned + bytes > chunkEnd) {
+                nextChunk(bytes + alignment);
+                aligned = alignUp(offset, alignment);
+            }
+            offset = aligned + bytes;
+            used += bytes;
+            if (used > peak) {
+                peak = used;
+            }
+            return aligned;
         }
 
-        template<typename T> inline T* alloc() {
-            void* lOffset = offset;
-            offset += sizeof(T);
-            return static_cast<T*>(lOffset);
+        [[nodiscard]] inline Mark mark() const {
+            return {.chunkIndex = current, .offset = offset, .used = used, .finalizerCount = finalizers.size()};
+        }
+
+        // Frees everything allocated since the mark was taken. Chunks stay reserved so they can be reused.
+        inline void rewind(const Mark& mark) {
+            runFinalizers(mark.finalizerCount);
+            current = mark.chunkIndex;
+            offset = mark.offset;
+            chunkEnd = chunks[current].begin + chunks[current].size;
+            used = mark.used;
+        }
+
+        inline void reset() {
+            rewind({.chunkIndex = 0, .offset = chunks[0].begin, .used = 0, .finalizerCount = 0});
+        }
+
+        [[nodiscard]] inline Stats stats() const {
+            size_t reserved = 0;
+            for (const Chunk& chunk: chunks) {
+                reserved += chunk.size;
+            }
+            return {.bytesUsed = used, .peakBytesUsed = peak, .bytesReserved = reserved, .chunkCount = chunks.size()};
         }
 
         inline ArenaAllocator(const ArenaAllocator& other) = delete;
 
-        inline ArenaAllocator operator=(const ArenaAllocator& other) = delete;
+        inline ArenaAllocator& operator=(const ArenaAllocator& other) = delete;
 
         inline ~ArenaAllocator() {
-            free(buffer);
+            runFinalizers(0);
+            for (const Chunk& chunk: chunks) {
+                free(chunk.begin);
+            }
         }
 
     private:
-        size_t size;
-        std::byte* buffer;
-        std::byte* offset;
-};
\ No newline at end of file
+        struct Chunk {
+            std::byte* begin;
+            size_t size;
+        };
+
+        struct Finalizer {
+            void* object;
+            void (*destroy)(void*);
+        };
+
+        static inline std::byte* alignUp(std::byte* ptr, size_t alignment) {
+            auto address = reinterpret_cast<uintptr_t>(ptr);
+            return ptr + ((alignment - (address & (alignment - 1))) & (alignment - 1));
+        }
+
+        static inline void* checkedMalloc(size_t bytes) {
+            void* memory = malloc(bytes);
+            if (memory == nullptr) {
+                std::cerr << "Arena out of memory allocating " << bytes << " bytes" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            return memory;
+        }
+
+        // Moves on to the next chunk that can hold `bytes`, reusing chunks kept around by rewind() when they are big enough.
+        inline void nextChunk(size_t bytes) {
+            while (current + 1 < chunks.size()) {
+                current++;
+                offset = chunks[current].begin;
+                chunkEnd = offset + chunks[current].size;
+                if (chunks[current].size >= bytes) {
+                    return;
+                }
+            }
+            size_t size = chunks[current].size * 2;
+            while (size < bytes) {
+                size *= 2;
+            }
+            addChunk(size);
+        }
+
+        inline void addChunk(size_t size) {
+            chunks.push_back({.begin = static_cast<std::byte*>(checkedMalloc(size)), .size = size});
+            current = chunks.size() - 1;
+            offset = chunks[current].begin;
+            chunkEnd = offset + size;
+        }
+
+        inline void addFinalizer(void* object, void (*destroy)(void*)) {
+            finalizers.push_back({.object = object, .destroy = destroy});
+        }
+
+        inline void runFinalizers(size_t keep) {
+            while (finalizers.size() > keep) {
+                finalizers.back().destroy(finalizers.back().object);
+                finalizers.pop_back();
+            }
+        }
+
+        std::vector<Chunk> chunks;
+        size_t current = 0;
+        std::byte* offset = nullptr;
+        std::byte* chunkEnd = nullptr;
+        size_t used = 0;
+        size_t peak = 0;
+        std::vector<Finalizer> finalizers;
+};
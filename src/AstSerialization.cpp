@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "Diagnostics.cpp"
+#include "Files.cpp"
+#include "Parser.cpp"
+
+// Binary AST file. Every section is a raw copy of one NodeProgram array at an 8 byte aligned offset
+// from the start of the file, so a mapped file is used in place with no parsing and no pointer
+// fixups. Only the tokens of identifier and declaration nodes are kept, and their text lives once
+// per symbol in the string pool; other nodes have no token.
+struct AstFileHeader {
+    static constexpr char expectedMagic[8] = {'H', 'E', 'L', 'I', 'A', 'S', 'T', '\0'};
+    // Bumped whenever the layout of the header, Token or NodeKind changes.
+    static constexpr uint32_t currentVersion = 1;
+    static constexpr uint32_t byteOrderMark = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeCount;
+    uint32_t stmtCount;
+    uint32_t tokenCount;
+    uint32_t symbolCount;
+    uint64_t poolSize;
+    uint64_t kindsOffset;
+    uint64_t tokenIndicesOffset;
+    uint64_t lhsOffset;
+    uint64_t rhsOffset;
+    uint64_t stmtsOffset;
+    uint64_t tokensOffset;
+    uint64_t poolOffset;
+};
+
+static_assert(std::is_trivially_copyable_v<AstFileHeader> && sizeof(AstFileHeader) == 96);
+static_assert(sizeof(Token) == 16 && sizeof(NodeKind) == 1);
+
+class AstWriter {
+    public:
+        inline explicit AstWriter(const NodeProgram& pProgram): program(pProgram) {
+        }
+
+        [[nodiscard]] std::string serializeProgram() const {
+            // Keeps the token of every node that names a variable and pools each name once.
+            std::vector<Token> tokens;
+            std::vector<uint32_t> tokenIndices(program.nodeCount(), NodeProgram::noToken);
+            std::vector<uint32_t> poolOffsets(program.symbolCount, UINT32_MAX);
+            std::string pool;
+            for (NodeIndex node = 0; node < program.nodeCount(); ++node) {
+                NodeKind kind = program.kinds[node];
+                if (kind != NodeKind::ident && kind != NodeKind::stmt_var) {
+                    continue;
+                }
+                Token token = program.tokens[program.tokenIndices[node]];
+                uint32_t& offset = poolOffsets[token.symbol];
+                if (offset == UINT32_MAX) {
+                    offset = static_cast<uint32_t>(pool.size());
+                    pool.append(program.text(node));
+                }
+                token.offset = offset;
+                tokenIndices[node] = static_cast<uint32_t>(tokens.size());
+                tokens.push_back(token);
+            }
+
+            AstFileHeader header {};
+            std::memcpy(header.magic, AstFileHeader::expectedMagic, sizeof(header.magic));
+            header.version = AstFileHeader::currentVersion;
+            header.byteOrder = AstFileHeader::byteOrderMark;
+            header.nodeCount = static_cast<uint32_t>(program.nodeCount());
+            header.stmtCount = static_cast<uint32_t>(program.stmts.size());
+            header.tokenCount = static_cast<uint32_t>(tokens.size());
+            header.symbolCount = program.symbolCount;
+            header.poolSize = pool.size();
+            uint64_t end = sizeof(AstFileHeader);
+            auto place = [&end](uint64_t bytes) {
+                uint64_t offset = end;
+                end = (end + bytes + 7) & ~uint64_t(7);
+                return offset;
+            };
+            header.kindsOffset = place(program.nodeCount() * sizeof(NodeKind));
+            header.tokenIndicesOffset = place(program.nodeCount() * sizeof(uint32_t));
+            header.lhsOffset = place(program.nodeCount() * sizeof(NodeIndex));
+            header.rhsOffset = place(program.nodeCount() * sizeof(NodeIndex));
+            header.stmtsOffset = place(program.stmts.size() * sizeof(NodeIndex));
+            header.tokensOffset = place(tokens.size() * sizeof(Token));
+            header.poolOffset = place(pool.size());
+
+            std::string file(end, '\0');
+            std::memcpy(file.data(), &header, sizeof(header));
+            copySection(file, header.kindsOffset, program.kinds.begin(), program.nodeCount());
+            copySection(file, header.tokenIndicesOffset, tokenIndices.data(), tokenIndices.size());
+            copySection(file, header.lhsOffset, program.lhs.begin(), program.nodeCount());
+            copySection(file, header.rhsOffset, program.rhs.begin(), program.nodeCount());
+            copySection(file, header.stmtsOffset, program.stmts.begin(), program.stmts.size());
+            copySection(file, header.tokensOffset, tokens.data(), tokens.size());
+            copySection(file, header.poolOffset, pool.data(), pool.size());
+            return file;
+        }
+
+        // Serializes the program and writes it to `path` with a single write call.
+        void writeProgram(const std::string& path) const {
+            std::string file = serializeProgram();
+            writeFile(path, file.data(), file.size(), 0644);
+        }
+
+    private:
+        template<typename T> static void copySection(std::string& file, uint64_t offset, const T* data, size_t count) {
+            if (count > 0) {
+                std::memcpy(file.data() + offset, data, count * sizeof(T));
+            }
+        }
+
+        const NodeProgram& program;
+};
+
+// Loads a binary AST in place: the returned program's arrays point into `file`, which must outlive
+// it. Everything a pass relies on is checked first, so a truncated or corrupt file is an error
+// rather than a crash. Children must come before their parents, as the parser writes them.
+class AstReader {
+    public:
+        [[nodiscard]] static NodeProgram readProgram(std::string_view file) {
+            if (file.size() < sizeof(AstFileHeader)) {
+                throw CompileError("Not a Helium AST file");
+            }
+            AstFileHeader header {};
+            std::memcpy(&header, file.data(), sizeof(header));
+            if (std::memcmp(header.magic, AstFileHeader::expectedMagic, sizeof(header.magic)) != 0) {
+                throw CompileError("Not a Helium AST file");
+            }
+            if (header.version != AstFileHeader::currentVersion || header.byteOrder != AstFileHeader::byteOrderMark) {
+                throw CompileError("Unsupported AST file version " + std::to_string(header.version));
+            }
+
+            NodeProgram program;
+            program.kinds = section<NodeKind>(file, header.kindsOffset, header.nodeCount);
+            program.tokenIndices = section<uint32_t>(file, header.tokenIndicesOffset, header.nodeCount);
+            program.lhs = section<NodeIndex>(file, header.lhsOffset, header.nodeCount);
+            program.rhs = section<NodeIndex>(file, header.rhsOffset, header.nodeCount);
+            program.stmts = section<NodeIndex>(file, header.stmtsOffset, header.stmtCount);
+            program.tokens = section<Token>(file, header.tokensOffset, header.tokenCount);
+            program.source = file.substr(checkedRange(file, header.poolOffset, header.poolSize), header.poolSize);
+            program.symbolCount = header.symbolCount;
+            validate(program);
+            return program;
+        }
+
+    private:
+        static uint64_t checkedRange(std::string_view file, uint64_t offset, uint64_t bytes) {
+            if (offset > file.size() || bytes > file.size() - offset) {
+                throw CompileError("Truncated AST file");
+            }
+            return offset;
+        }
+
+        template<typename T> static NodeArray<T> section(std::string_view file, uint64_t offset, uint64_t count) {
+            checkedRange(file, offset, count * sizeof(T));
+            const char* start = file.data() + offset;
+            if (reinterpret_cast<uintptr_t>(start) % alignof(T) != 0) {
+                throw CompileError("Misaligned AST file section");
+            }
+            return NodeArray<T>::mapped(reinterpret_cast<const T*>(start), count);
+        }
+
+        [[nodiscard]] static bool isExpr(NodeKind kind) {
+            return kind == NodeKind::int_lit || kind == NodeKind::ident || kind == NodeKind::add || kind == NodeKind::mul;
+        }
+
+        static void validate(const NodeProgram& p) {
+            for (const Token& token: p.tokens) {
+                if (token.type != TokenType::ident || token.symbol >= p.symbolCount || token.offset > p.source.size() || token.length > p.source.size() - token.offset) {
+                    throw CompileError("Corrupt AST file: bad token");
+                }
+            }
+            for (NodeIndex node = 0; node < p.nodeCount(); ++node) {
+                NodeKind kind = p.kinds[node];
+                bool valid;
+                switch (kind) {
+                    case NodeKind::int_lit:
+                        valid = true;
+                        break;
+                    case NodeKind::ident:
+                        valid = p.tokenIndices[node] < p.tokens.size();
+                        break;
+                    case NodeKind::add:
+                    case NodeKind::mul:
+                        valid = p.lhs[node] < node && p.rhs[node] < node && isExpr(p.kinds[p.lhs[node]]) && isExpr(p.kinds[p.rhs[node]]);
+                        break;
+                    case NodeKind::stmt_exit:
+                        valid = p.lhs[node] < node && isExpr(p.kinds[p.lhs[node]]);
+                        break;
+                    case NodeKind::stmt_var:
+                        valid = p.lhs[node] < node && isExpr(p.kinds[p.lhs[node]]) && p.tokenIndices[node] < p.tokens.size();
+                        break;
+                    default:
+                        valid = false;
+                        break;
+                }
+                if (!valid) {
+                    throw CompileError("Corrupt AST file: bad node " + std::to_string(node));
+                }
+            }
+            for (NodeIndex stmt: p.stmts) {
+                if (stmt >= p.nodeCount() || isExpr(p.kinds[stmt])) {
+                    throw CompileError("Corrupt AST file: bad statement");
+                }
+            }
+        }
+};
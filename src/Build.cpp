@@ -0,0 +1,306 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Arena.cpp"
+#include "Cache.cpp"
+#include "Diagnostics.cpp"
+#include "Source.cpp"
+#include "Tokenization.cpp"
+#include "Parser.cpp"
+#include "IR.cpp"
+#include "Generation.cpp"
+#include "MachineCode.cpp"
+#include "Encoding.cpp"
+#include "Elf.cpp"
+#include "Instrumentation.cpp"
+#include "Peephole.cpp"
+#include "Pipeline.cpp"
+#include "ThreadPool.cpp"
+
+struct BuildOptions {
+    std::string os;
+    // "exe" or "asm"
+    std::string emit;
+    int optimizationLevel = 1;
+    // Empty to write every output next to its source file.
+    std::string outDir;
+    // Zero for one worker per core.
+    size_t jobs = 0;
+    // Empty to build without the cache.
+    std::string cacheDir;
+    uint64_t cacheLimit = CompileCache::defaultLimit;
+    PeepholeOptions peephole {};
+    // Prints the peephole rewrites of all files together.
+    bool verbose = false;
+};
+
+// Thread pool plus one IR arena per worker. A build normally makes its own; the compile server keeps
+// one alive across requests so every build after the first starts with warm threads and arenas.
+class BuildWorkers {
+    public:
+        inline explicit BuildWorkers(size_t threadCount): pool(threadCount == 0 ? std::thread::hardware_concurrency() : threadCount) {
+            for (size_t i = 0; i < pool.size(); ++i) {
+                arenas.push_back(std::make_unique<ArenaAllocator>());
+            }
+        }
+
+        ThreadPool pool;
+        std::vector<std::unique_ptr<ArenaAllocator>> arenas;
+};
+
+// Compiles many files at once for `helium build`. Every file is its own task on a work-stealing
+// pool, each worker reuses one IR arena for all of its files, and every file gets its own output
+// path. Diagnostics and timings are collected per file and reported in input order at the end.
+// Phases are recorded in `instrumentation` with the file as their detail, on the worker's thread.
+class BatchBuilder {
+    public:
+        inline BatchBuilder(BuildOptions pOptions, Instrumentation& pInstrumentation): options(std::move(pOptions)), instrumentation(pInstrumentation) {
+        }
+
+        // Runs on `pWorkers` instead of starting a pool; options.jobs is ignored.
+        inline BatchBuilder(BuildOptions pOptions, Instrumentation& pInstrumentation, BuildWorkers& pWorkers): options(std::move(pOptions)), instrumentation(pInstrumentation), sharedWorkers(&pWorkers) {
+        }
+
+        // Replaces every directory with the .he files below it and every @file with the paths it
+        // lists, one per line. Duplicates are dropped.
+        [[nodiscard]] static std::vector<std::string> expandInputs(const std::vector<std::string>& inputs) {
+            std::vector<std::string> files;
+            std::set<std::filesystem::path> seen;
+            auto add = [&](const std::filesystem::path& path) {
+                if (seen.insert(std::filesystem::weakly_canonical(path)).second) {
+                    files.push_back(path.string());
+                }
+            };
+            for (const std::string& input: inputs) {
+                if (input.starts_with("@")) {
+                    std::ifstream manifest(input.substr(1));
+                    if (!manifest) {
+                        throw CompileError("Unable to open " + input.substr(1));
+                    }
+                    std::string line;
+                    while (std::getline(manifest, line)) {
+                        if (!line.empty()) {
+                            add(line);
+                        }
+                    }
+                } else if (std::filesystem::is_directory(input)) {
+                    std::vector<std::filesystem::path> found;
+                    for (const auto& entry: std::filesystem::recursive_directory_iterator(input)) {
+                        if (entry.is_regular_file() && entry.path().extension() == ".he") {
+                            found.push_back(entry.path());
+                        }
+                    }
+                    std::sort(found.begin(), found.end());
+                    for (const auto& path: found) {
+                        add(path);
+                    }
+                } else {
+                    add(input);
+                }
+            }
+            return files;
+        }
+
+        // Builds every file and reports the results to `output`, with diagnostics on `diagnostics`.
+        // Returns whether all of them compiled.
+        bool build(const std::vector<std::string>& files, std::ostream& output = std::cout, std::ostream& diagnostics = std::cerr) {
+            units.clear();
+            units.reserve(files.size());
+            std::unordered_map<std::string, const std::string*> outputs;
+            for (const std::string& file: files) {
+                units.push_back({.source = file, .output = outputPathFor(file)});
+                auto [existing, inserted] = outputs.insert({units.back().output, &file});
+                if (!inserted) {
+                    throw CompileError(file + " and " + *existing->second + " would both be written to " + existing->first);
+                }
+            }
+
+            if (!options.cacheDir.empty()) {
+                cache.emplace(options.cacheDir, options.cacheLimit);
+            }
+            auto start = std::chrono::steady_clock::now();
+            {
+                std::optional<BuildWorkers> ownWorkers;
+                BuildWorkers& workers = sharedWorkers != nullptr ? *sharedWorkers : ownWorkers.emplace(options.jobs);
+                threadCount = workers.pool.size();
+                for (Unit& unit: units) {
+                    workers.pool.submit([this, &unit, &workers] {
+                        compileUnit(unit, *workers.arenas[ThreadPool::currentWorker()]);
+                    });
+                }
+                workers.pool.wait();
+            }
+            totalMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            bool succeeded = report(output, diagnostics);
+            if (cache.has_value()) {
+                cache->flushStats();
+            }
+            return succeeded;
+        }
+
+    private:
+        struct Unit {
+            std::string source;
+            std::string output;
+            std::string diagnostic {};
+            double milliseconds = 0;
+            bool succeeded = false;
+            bool cached = false;
+        };
+
+        [[nodiscard]] std::string outputPathFor(const std::string& source) const {
+            std::filesystem::path path(source);
+            if (!options.outDir.empty()) {
+                path = std::filesystem::path(options.outDir) / path.filename();
+            }
+            path.replace_extension(options.emit == "asm" ? ".asm" : "");
+            if (path == std::filesystem::path(source)) {
+                path += ".out";
+            }
+            return path.string();
+        }
+
+        void compileUnit(Unit& unit, ArenaAllocator& arena) {
+            auto start = std::chrono::steady_clock::now();
+            try {
+                SourceBuffer source = instrumentation.time("read source", unit.source, [&] {
+                    return SourceBuffer::open(unit.source);
+                });
+                instrumentation.count("source bytes", source.view().size());
+                std::string cacheKey;
+                if (cache.has_value()) {
+                    cacheKey = CompileCache::keyFor(source.view(), options.os, "-O" + std::to_string(options.optimizationLevel) + " --emit=" + options.emit + " " + options.peephole.flags());
+                    bool fetched = instrumentation.time("cache lookup", unit.source, [&] {
+                        return cache->fetch(cacheKey, options.emit, unit.output);
+                    });
+                    if (fetched) {
+                        unit.succeeded = true;
+                        unit.cached = true;
+                        unit.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                        return;
+                    }
+                }
+                std::vector<Token> tokens = instrumentation.time("tokenize", unit.source, [&] {
+                    Tokenizer tokenizer(source.view());
+                    return tokenizer.tokenize();
+                });
+                instrumentation.count("tokens", tokens.size());
+                Parser parser(std::move(tokens), source.view());
+                std::optional<NodeProgram> root = instrumentation.time("parse", unit.source, [&] {
+                    return parser.parseProgram();
+                });
+                if (!root.has_value()) {
+                    throw CompileError("No exit node found!");
+                }
+                instrumentation.count("AST nodes", root->nodeCount());
+                CompilePipeline pipeline(options.optimizationLevel, options.peephole);
+                if (pipeline.foldsConstants()) {
+                    Instrumentation::Scope scope(instrumentation, "fold constants", unit.source);
+                    CompilePipeline::foldConstants(root.value());
+                }
+
+                MachineProgram program;
+                {
+                    IRModule module(arena);
+                    instrumentation.time("lower IR", unit.source, [&] {
+                        CompilePipeline::lower(module, root.value());
+                    });
+                    if (pipeline.optimizesIR()) {
+                        Instrumentation::Scope scope(instrumentation, "optimize IR", unit.source);
+                        CompilePipeline::optimizeIR(module);
+                    }
+                    instrumentation.count("IR values", module.valueCount());
+                    program = instrumentation.time("generate", unit.source, [&] {
+                        Generator generator(module, options.os);
+                        return generator.generateProgram();
+                    });
+                    instrumentation.count("arena bytes", module.arenaStats().peakBytesUsed);
+                }
+                arena.reset();
+                if (pipeline.runsPeephole()) {
+                    PeepholeOptimizer::Stats rewrites = instrumentation.time("peephole", unit.source, [&] {
+                        return pipeline.optimizeMachineCode(program);
+                    });
+                    instrumentation.count("peephole rewrites", rewrites.total());
+                    std::lock_guard<std::mutex> lock(peepholeMutex);
+                    peepholeStats.merge(rewrites);
+                }
+                instrumentation.count("instructions", program.insts.size());
+
+                if (options.emit == "asm") {
+                    Instrumentation::Scope scope(instrumentation, "write asm", unit.source);
+                    AsmWriter writer(program);
+                    writer.writeProgram(unit.output);
+                } else {
+                    std::vector<uint8_t> code = instrumentation.time("encode", unit.source, [&] {
+                        X86Encoder encoder;
+                        return encoder.encodeProgram(program);
+                    });
+                    instrumentation.count("code bytes", code.size());
+                    Instrumentation::Scope scope(instrumentation, "write executable", unit.source);
+                    ElfWriter writer(code, options.os == "BSD" ? ElfWriter::osAbiFreeBsd : ElfWriter::osAbiSysV);
+                    writer.writeExecutable(unit.output);
+                }
+                if (cache.has_value()) {
+                    Instrumentation::Scope scope(instrumentation, "cache store", unit.source);
+                    cache->storeFile(cacheKey, options.emit, unit.output);
+                }
+                unit.succeeded = true;
+            } catch (const std::exception& exception) {
+                arena.reset();
+                unit.diagnostic = exception.what();
+            }
+            unit.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        bool report(std::ostream& output, std::ostream& diagnostics) const {
+            size_t succeeded = 0;
+            char line[64];
+            for (const Unit& unit: units) {
+                std::snprintf(line, sizeof(line), "%9.2f ms  ", unit.milliseconds);
+                if (unit.succeeded) {
+                    output << line << unit.source << " -> " << unit.output << (unit.cached ? " (cached)\n" : "\n");
+                    succeeded++;
+                } else {
+                    output << line << unit.source << " FAILED\n";
+                }
+            }
+            for (const Unit& unit: units) {
+                if (!unit.succeeded) {
+                    diagnostics << unit.source << ": " << unit.diagnostic << "\n";
+                }
+            }
+            std::snprintf(line, sizeof(line), "%.2f ms", totalMilliseconds);
+            output << "Built " << succeeded << " of " << units.size() << " files in " << line << " on " << threadCount << (threadCount == 1 ? " thread" : " threads") << std::endl;
+            if (options.verbose && options.peephole.runsAt(options.optimizationLevel)) {
+                diagnostics << peepholeStats.report();
+            }
+            if (cache.has_value()) {
+                output << "Cache: " << cache->sessionHits() << " hits, " << cache->sessionMisses() << " misses" << std::endl;
+            }
+            return succeeded == units.size();
+        }
+
+        BuildOptions options;
+        Instrumentation& instrumentation;
+        BuildWorkers* sharedWorkers = nullptr;
+        std::optional<CompileCache> cache {};
+        std::vector<Unit> units {};
+        size_t threadCount = 0;
+        double totalMilliseconds = 0;
+        std::mutex peepholeMutex;
+        PeepholeOptimizer::Stats peepholeStats {};
+};
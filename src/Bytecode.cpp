@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Diagnostics.cpp"
+#include "Parser.cpp"
+#include "Symbols.cpp"
+
+// Register bytecode for the interpreter. Every var gets its own register; the registers after the
+// vars hold temporaries, which are reused from one statement to the next.
+enum class BcOp : uint8_t {
+    // dst = constants[lhs]
+    constant,
+    // dst = lhs; loads and stores of var registers
+    move,
+    add,
+    mul,
+    // returns lhs
+    exit
+};
+
+struct BcInst {
+    BcOp op;
+    uint32_t dst;
+    uint32_t lhs;
+    uint32_t rhs;
+};
+
+struct BytecodeProgram {
+    std::vector<BcInst> code;
+    std::vector<uint64_t> constants;
+    uint32_t registerCount = 0;
+};
+
+// Compiles a NodeProgram to bytecode. Identifiers are resolved to registers here, so nothing walks
+// the AST at run time.
+class BytecodeCompiler {
+    public:
+        inline explicit BytecodeCompiler(const NodeProgram& pRoot): root(pRoot), vars(pRoot.symbolCount) {
+        }
+
+        [[nodiscard]] BytecodeProgram compileProgram() {
+            for (NodeIndex stmt: root.stmts) {
+                if (root.kinds[stmt] == NodeKind::stmt_var) {
+                    tempBase++;
+                }
+            }
+            for (NodeIndex stmt: root.stmts) {
+                compileStmt(stmt);
+            }
+            uint32_t zero = compileConstant(0, std::nullopt);
+            emit(BcOp::exit, 0, zero, 0);
+            program.registerCount = tempBase + maxTemps;
+            return std::move(program);
+        }
+
+    private:
+        void compileStmt(NodeIndex stmt) {
+            nextTemp = tempBase;
+            if (root.kinds[stmt] == NodeKind::stmt_exit) {
+                emit(BcOp::exit, 0, compileExpr(root.lhs[stmt], std::nullopt), 0);
+                return;
+            }
+            // The value is computed straight into the var's register, which becomes visible afterwards.
+            uint32_t reg = static_cast<uint32_t>(vars.size());
+            compileExpr(root.lhs[stmt], reg);
+            if (!vars.declare(root.symbol(stmt), reg)) {
+                throw CompileError("Identifier already used!" + std::string(root.text(stmt)));
+            }
+        }
+
+        // Returns the register holding the value, which is `target` when one is given.
+        uint32_t compileExpr(NodeIndex expr, std::optional<uint32_t> target) {
+            switch (root.kinds[expr]) {
+                case NodeKind::int_lit:
+                    return compileConstant(root.literalValue(expr), target);
+                case NodeKind::ident: {
+                    const uint32_t* found = vars.find(root.symbol(expr));
+                    if (found == nullptr) {
+                        throw CompileError("Undeclared identifier: " + std::string(root.text(expr)));
+                    }
+                    if (target.has_value() && target.value() != *found) {
+                        emit(BcOp::move, target.value(), *found, 0);
+                        return target.value();
+                    }
+                    return *found;
+                }
+                default: {
+                    BcOp op = root.kinds[expr] == NodeKind::add ? BcOp::add : BcOp::mul;
+                    uint32_t mark = nextTemp;
+                    uint32_t lhs = compileExpr(root.lhs[expr], std::nullopt);
+                    uint32_t rhs = compileExpr(root.rhs[expr], std::nullopt);
+                    // Operands are read before the result is written, so it may reuse their temporaries.
+                    nextTemp = mark;
+                    uint32_t dst = target.has_value() ? target.value() : allocTemp();
+                    emit(op, dst, lhs, rhs);
+                    return dst;
+                }
+            }
+        }
+
+        uint32_t compileConstant(uint64_t value, std::optional<uint32_t> target) {
+            uint32_t dst = target.has_value() ? target.value() : allocTemp();
+            emit(BcOp::constant, dst, static_cast<uint32_t>(program.constants.size()), 0);
+            program.constants.push_back(value);
+            return dst;
+        }
+
+        uint32_t allocTemp() {
+            maxTemps = std::max(maxTemps, nextTemp - tempBase + 1);
+            return nextTemp++;
+        }
+
+        void emit(BcOp op, uint32_t dst, uint32_t lhs, uint32_t rhs) {
+            program.code.push_back({.op = op, .dst = dst, .lhs = lhs, .rhs = rhs});
+        }
+
+        const NodeProgram& root;
+        BytecodeProgram program;
+        uint32_t tempBase = 0;
+        uint32_t nextTemp = 0;
+        uint32_t maxTemps = 0;
+        SymbolTable<uint32_t> vars;
+};
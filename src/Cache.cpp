@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Diagnostics.cpp"
+
+#ifndef HELIUM_VERSION
+#define HELIUM_VERSION "dev"
+#endif
+
+// On-disk cache of compiler outputs, addressed by a hash of the source bytes, the target OS, the
+// compiler build and the flags. Files are written under a temporary name and renamed into place,
+// so any number of compiler processes can share one directory. Hits refresh an artifact's mtime,
+// and once the directory outgrows its limit the least recently used artifacts are removed.
+class CompileCache {
+    public:
+        struct Stats {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t entries;
+            uint64_t bytes;
+        };
+
+        static constexpr uint64_t defaultLimit = 512ull * 1024 * 1024;
+
+        inline explicit CompileCache(std::string pDirectory, uint64_t pLimit = defaultLimit): directory(std::move(pDirectory)), limit(pLimit) {
+            std::error_code ignored;
+            std::filesystem::create_directories(directory + "/objects", ignored);
+            std::filesystem::create_directories(directory + "/tmp", ignored);
+            if (!std::filesystem::is_directory(directory + "/objects")) {
+                throw CompileError("Unable to create cache directory " + directory);
+            }
+        }
+
+        // 128 bit key as 32 hex digits. The compiler build is part of the key, so a new compiler
+        // never sees artifacts of an old one.
+        [[nodiscard]] static std::string keyFor(std::string_view source, std::string_view os, std::string_view flags) {
+            std::string metadata = HELIUM_VERSION " " __DATE__ " " __TIME__;
+            metadata.append(1, '\0').append(os).append(1, '\0').append(flags);
+            uint64_t seed = hash(metadata, 0);
+            uint64_t halves[2] = {hash(source, seed), hash(source, seed ^ 0x9E3779B97F4A7C15ull)};
+            char key[33];
+            std::snprintf(key, sizeof(key), "%016llx%016llx", static_cast<unsigned long long>(halves[0]), static_cast<unsigned long long>(halves[1]));
+            return key;
+        }
+
+        // Copies the `kind` artifact of `key` to `path` and counts a hit, or counts a miss.
+        bool fetch(const std::string& key, std::string_view kind, const std::string& path) {
+            bool found = restore(key, kind, path);
+            (found ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+            return found;
+        }
+
+        // Like fetch, for the secondary artifacts of an entry; nothing is counted.
+        bool restore(const std::string& key, std::string_view kind, const std::string& path) {
+            std::string artifact = artifactPath(key, kind);
+            struct stat info {};
+            if (stat(artifact.c_str(), &info) != 0) {
+                return false;
+            }
+            std::string temporary = temporaryPath(path);
+            std::error_code failed;
+            std::filesystem::copy_file(artifact, temporary, std::filesystem::copy_options::overwrite_existing, failed);
+            if (failed || chmod(temporary.c_str(), info.st_mode & 0777) != 0 || rename(temporary.c_str(), path.c_str()) != 0) {
+                unlink(temporary.c_str());
+                return false;
+            }
+            utimensat(AT_FDCWD, artifact.c_str(), nullptr, 0);
+            return true;
+        }
+
+        // Adds the file at `path` as the `kind` artifact of `key`. Failing to cache is not an error.
+        void storeFile(const std::string& key, std::string_view kind, const std::string& path) {
+            std::string artifact = artifactPath(key, kind);
+            std::error_code failed;
+            std::filesystem::create_directories(std::filesystem::path(artifact).parent_path(), failed);
+            std::string temporary = directory + "/tmp/" + key + "." + std::string(kind) + "." + uniqueSuffix();
+            std::filesystem::copy_file(path, temporary, std::filesystem::copy_options::overwrite_existing, failed);
+            if (failed || rename(temporary.c_str(), artifact.c_str()) != 0) {
+                unlink(temporary.c_str());
+                return;
+            }
+            uint64_t size = std::filesystem::file_size(artifact, failed);
+            std::lock_guard<std::mutex> lock(evictionMutex);
+            if (estimatedBytes == UINT64_MAX) {
+                estimatedBytes = scan().bytes;
+            } else {
+                estimatedBytes += failed ? 0 : size;
+            }
+            if (estimatedBytes > limit) {
+                evict();
+            }
+        }
+
+        // Totals recorded by every process that used the directory, plus this one's unflushed counts.
+        [[nodiscard]] Stats stats() {
+            Stats result = scan();
+            uint64_t recorded[2] = {0, 0};
+            updateStatsFile(recorded, false);
+            result.hits = recorded[0] + hits.load(std::memory_order_relaxed);
+            result.misses = recorded[1] + misses.load(std::memory_order_relaxed);
+            return result;
+        }
+
+        [[nodiscard]] uint64_t sessionHits() const {
+            return hits.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] uint64_t sessionMisses() const {
+            return misses.load(std::memory_order_relaxed);
+        }
+
+        // Adds this process' hits and misses to the totals in the directory.
+        void flushStats() {
+            uint64_t counts[2] = {hits.exchange(0), misses.exchange(0)};
+            if (counts[0] != 0 || counts[1] != 0) {
+                updateStatsFile(counts, true);
+            }
+        }
+
+        void clear() {
+            std::error_code ignored;
+            std::filesystem::remove_all(directory + "/objects", ignored);
+            std::filesystem::remove(directory + "/stats", ignored);
+            std::filesystem::create_directories(directory + "/objects", ignored);
+            estimatedBytes = UINT64_MAX;
+        }
+
+    private:
+        struct Artifact {
+            std::filesystem::path path;
+            std::filesystem::file_time_type lastUse;
+            uint64_t size;
+        };
+
+        [[nodiscard]] std::string artifactPath(const std::string& key, std::string_view kind) const {
+            return directory + "/objects/" + key.substr(0, 2) + "/" + key + "." + std::string(kind);
+        }
+
+        static std::string temporaryPath(const std::string& path) {
+            return path + ".tmp." + uniqueSuffix();
+        }
+
+        static std::string uniqueSuffix() {
+            static std::atomic<uint64_t> counter = 0;
+            thread_local std::mt19937_64 random(std::random_device{}());
+            char suffix[64];
+            std::snprintf(suffix, sizeof(suffix), "%d.%llu.%llx", getpid(), static_cast<unsigned long long>(counter.fetch_add(1)), static_cast<unsigned long long>(random()));
+            return suffix;
+        }
+
+        [[nodiscard]] Stats scan() const {
+            Stats result {.hits = 0, .misses = 0, .entries = 0, .bytes = 0};
+            std::error_code failed;
+            for (const auto& entry: std::filesystem::recursive_directory_iterator(directory + "/objects", failed)) {
+                std::error_code sizeFailed;
+                if (entry.is_regular_file(sizeFailed)) {
+                    result.entries++;
+                    result.bytes += entry.file_size(sizeFailed);
+                }
+            }
+            return result;
+        }
+
+        // Removes the least recently used artifacts until the cache is back to 90% of its limit.
+        // Another process may remove the same files concurrently; those removals just fail.
+        void evict() {
+            std::vector<Artifact> artifacts;
+            uint64_t total = 0;
+            std::error_code failed;
+            for (const auto& entry: std::filesystem::recursive_directory_iterator(directory + "/objects", failed)) {
+                std::error_code entryFailed;
+                if (entry.is_regular_file(entryFailed)) {
+                    artifacts.push_back({entry.path(), entry.last_write_time(entryFailed), entry.file_size(entryFailed)});
+                    total += artifacts.back().size;
+                }
+            }
+            std::sort(artifacts.begin(), artifacts.end(), [](const Artifact& lhs, const Artifact& rhs) {
+                return lhs.lastUse < rhs.lastUse;
+            });
+            uint64_t target = limit / 10 * 9;
+            for (const Artifact& artifact: artifacts) {
+                if (total <= target) {
+                    break;
+                }
+                std::filesystem::remove(artifact.path, failed);
+                total -= artifact.size;
+            }
+            estimatedBytes = total;
+        }
+
+        // Reads the recorded totals into `counts` and, when `add` is set, adds `counts` to them under
+        // an exclusive lock.
+        void updateStatsFile(uint64_t counts[2], bool add) const {
+            std::string path = directory + "/stats";
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (fd < 0) {
+                return;
+            }
+            flock(fd, add ? LOCK_EX : LOCK_SH);
+            char text[64] = {};
+            ssize_t length = pread(fd, text, sizeof(text) - 1, 0);
+            unsigned long long recorded[2] = {0, 0};
+            if (length > 0) {
+                std::sscanf(text, "hits %llu misses %llu", &recorded[0], &recorded[1]);
+            }
+            if (add) {
+                recorded[0] += counts[0];
+                recorded[1] += counts[1];
+                int written = std::snprintf(text, sizeof(text), "hits %llu misses %llu\n", recorded[0], recorded[1]);
+                if (ftruncate(fd, 0) == 0) {
+                    pwrite(fd, text, written, 0);
+                }
+            } else {
+                counts[0] = recorded[0];
+                counts[1] = recorded[1];
+            }
+            flock(fd, LOCK_UN);
+            close(fd);
+        }
+
+        static uint64_t mix(uint64_t lhs, uint64_t rhs) {
+            __uint128_t product = static_cast<__uint128_t>(lhs) * rhs;
+            return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+        }
+
+        static uint64_t read64(const char* p) {
+            uint64_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        // Multiply-fold hash over 16 bytes per step, in the style of wyhash.
+        static uint64_t hash(std::string_view data, uint64_t seed) {
+            constexpr uint64_t p0 = 0xa0761d6478bd642full;
+            constexpr uint64_t p1 = 0xe7037ed1a0b428dbull;
+            constexpr uint64_t p2 = 0x8ebc6af09c88c6e3ull;
+            const char* p = data.data();
+            size_t remaining = data.size();
+            seed ^= mix(seed ^ p0, p1);
+            while (remaining > 16) {
+                seed = mix(read64(p) ^ p1, read64(p + 8) ^ seed);
+                p += 16;
+                remaining -= 16;
+            }
+            char tail[16] = {};
+            std::memcpy(tail, p, remaining);
+            return mix(p2 ^ data.size(), mix(read64(tail) ^ p1, read64(tail + 8) ^ seed));
+        }
+
+        std::string directory;
+        uint64_t limit;
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::mutex evictionMutex;
+        // Bytes in the cache as of the last scan plus what this process stored since; UINT64_MAX
+        // until the first store scans the directory.
+        uint64_t estimatedBytes = UINT64_MAX;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <optional>
+#include <vector>
+#include "Diagnostics.cpp"
+#include "Parser.cpp"
+#include "Symbols.cpp"
+
+// Folds constant arithmetic and propagates variables bound to constants. Addition and
+// multiplication wrap at 64 bits, so both are associative and commutative and every constant in a
+// chain of the same operator can be combined no matter where it sits. Declarations whose value
+// folds to a constant are removed once their uses have been replaced.
+class ConstantFolder {
+    public:
+        inline explicit ConstantFolder(NodeProgram& pProgram): program(pProgram), declared(pProgram.symbolCount) {
+        }
+
+        void foldProgram() {
+            std::vector<NodeIndex> kept;
+            kept.reserve(program.stmts.size());
+            for (NodeIndex stmt: program.stmts) {
+                if (program.kinds[stmt] == NodeKind::stmt_exit) {
+                    foldExpr(program.lhs[stmt]);
+                    kept.push_back(stmt);
+                    continue;
+                }
+                std::optional<uint64_t> value = foldExpr(program.lhs[stmt]);
+                if (!declared.declare(program.symbol(stmt), value)) {
+                    throw CompileError("Identifier already used!" + std::string(program.text(stmt)));
+                }
+                if (!value.has_value()) {
+                    kept.push_back(stmt);
+                }
+            }
+            program.stmts = std::move(kept);
+        }
+
+        // Folds the expression in place and returns its value when it is constant.
+        std::optional<uint64_t> foldExpr(NodeIndex expr) {
+            NodeKind kind = program.kinds[expr];
+            switch (kind) {
+                case NodeKind::int_lit:
+                    return program.literalValue(expr);
+                case NodeKind::ident:
+                    return foldIdent(expr);
+                default:
+                    break;
+            }
+            bool isAdd = kind == NodeKind::add;
+            uint64_t identity = isAdd ? 0 : 1;
+
+            std::vector<NodeIndex> operands;
+            collectOperands(expr, kind, operands);
+
+            uint64_t constant = identity;
+            size_t constantCount = 0;
+            std::vector<NodeIndex> rest;
+            for (NodeIndex operand: operands) {
+                if (std::optional<uint64_t> value = foldExpr(operand)) {
+                    constant = isAdd ? constant + value.value() : constant * value.value();
+                    constantCount++;
+                } else {
+                    rest.push_back(operand);
+                }
+            }
+
+            if (rest.empty() || (!isAdd && constant == 0)) {
+                program.setLiteral(expr, constant);
+                return constant;
+            }
+            bool dropConstant = constantCount > 0 && constant == identity;
+            if (constantCount < 2 && !dropConstant) {
+                return {};
+            }
+            NodeIndex rebuilt = rest[0];
+            for (size_t i = 1; i < rest.size(); ++i) {
+                rebuilt = program.addNode(kind, NodeProgram::noToken, rebuilt, rest[i]);
+            }
+            if (!dropConstant) {
+                rebuilt = program.addNode(kind, NodeProgram::noToken, rebuilt, program.addLiteral(constant));
+            }
+            program.kinds[expr] = program.kinds[rebuilt];
+            program.tokenIndices[expr] = program.tokenIndices[rebuilt];
+            program.lhs[expr] = program.lhs[rebuilt];
+            program.rhs[expr] = program.rhs[rebuilt];
+            return {};
+        }
+
+    private:
+        std::optional<uint64_t> foldIdent(NodeIndex ident) {
+            // Checked here because folding may drop the identifier, e.g. when it is multiplied by zero.
+            const std::optional<uint64_t>* found = declared.find(program.symbol(ident));
+            if (found == nullptr) {
+                throw CompileError("Undeclared identifier: " + std::string(program.text(ident)));
+            }
+            if (found->has_value()) {
+                program.setLiteral(ident, found->value());
+            }
+            return *found;
+        }
+
+        // Flattens a chain of the same operator into its operands, left to right.
+        void collectOperands(NodeIndex expr, NodeKind kind, std::vector<NodeIndex>& operands) const {
+            if (program.kinds[expr] != kind) {
+                operands.push_back(expr);
+                return;
+            }
+            collectOperands(program.lhs[expr], kind, operands);
+            collectOperands(program.rhs[expr], kind, operands);
+        }
+
+        NodeProgram& program;
+        // Every declared variable, with its value when that is constant.
+        SymbolTable<std::optional<uint64_t>> declared;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Raised for errors in the program being compiled and in reading or writing its files. The command
+// line driver prints the message and exits; library users such as JitCompiler catch it and carry on.
+class CompileError : public std::runtime_error {
+    public:
+        inline explicit CompileError(const std::string& message): std::runtime_error(message) {
+        }
+};
+
+// A CompileError at a line and column of the source, both counted from 1, and reported as
+// "line:column: detail".
+class SourceError : public CompileError {
+    public:
+        inline SourceError(size_t pLine, size_t pColumn, const std::string& pDetail):
+            CompileError(std::to_string(pLine) + ":" + std::to_string(pColumn) + ": " + pDetail), line(pLine), column(pColumn), detail(pDetail) {
+        }
+
+        // The error at byte `offset` of `source`; columns count bytes.
+        [[nodiscard]] static SourceError at(std::string_view source, size_t offset, const std::string& detail) {
+            std::string_view before = source.substr(0, offset);
+            size_t lineStart = before.rfind('\n');
+            size_t column = lineStart == std::string_view::npos ? offset + 1 : offset - lineStart;
+            return {1 + static_cast<size_t>(std::count(before.begin(), before.end(), '\n')), column, detail};
+        }
+
+        size_t line;
+        size_t column;
+        std::string detail;
+};
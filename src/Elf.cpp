@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "Diagnostics.cpp"
+#include "Files.cpp"
+
+// Writes a static ELF64 x86-64 executable holding a single read+execute segment. The code starts
+// right after the ELF and program headers and execution begins at its first byte, so no section
+// headers, symbols or relocations are needed. The headers are also available on their own, for
+// executables written a piece at a time.
+class ElfWriter {
+    public:
+        static constexpr uint64_t baseAddress = 0x400000;
+        // Far above any code, so the data segment never overlaps it however large the code grows.
+        static constexpr uint64_t dataAddress = 0x10000000000;
+        static constexpr uint8_t osAbiSysV = 0;
+        static constexpr uint8_t osAbiFreeBsd = 9;
+
+        inline explicit ElfWriter(const std::vector<uint8_t>& pCode, uint8_t pOsAbi = osAbiSysV): code(pCode), osAbi(pOsAbi) {
+        }
+
+        [[nodiscard]] std::vector<uint8_t> buildImage() const {
+            uint64_t fileSize = headersSize(1) + code.size();
+            std::vector<uint8_t> image(fileSize);
+            writeHeaders(image.data(), fileSize, osAbi);
+            std::memcpy(image.data() + headersSize(1), code.data(), code.size());
+            return image;
+        }
+
+        // Bytes taken by the ELF header and `segmentCount` program headers, which the code follows.
+        [[nodiscard]] static constexpr uint64_t headersSize(uint16_t segmentCount) {
+            return sizeof(ElfHeader) + segmentCount * sizeof(ProgramHeader);
+        }
+
+        // Fills the start of a `fileSize` byte image with its headers. A nonzero `dataSize` adds a
+        // second, zero-filled read+write segment of that many bytes at dataAddress.
+        static void writeHeaders(uint8_t* image, uint64_t fileSize, uint8_t osAbi, uint64_t dataSize = 0) {
+            uint16_t segmentCount = dataSize == 0 ? 1 : 2;
+            ElfHeader header {};
+            const uint8_t ident[16] = {0x7F, 'E', 'L', 'F', 2, 1, 1, osAbi};
+            std::memcpy(header.ident, ident, sizeof(ident));
+            header.type = 2;
+            header.machine = 62;
+            header.version = 1;
+            header.entry = baseAddress + headersSize(segmentCount);
+            header.programHeaderOffset = sizeof(ElfHeader);
+            header.headerSize = sizeof(ElfHeader);
+            header.programHeaderSize = sizeof(ProgramHeader);
+            header.programHeaderCount = segmentCount;
+
+            ProgramHeader segments[2] {};
+            segments[0].type = 1;
+            segments[0].flags = 5;
+            segments[0].offset = 0;
+            segments[0].virtualAddress = baseAddress;
+            segments[0].physicalAddress = baseAddress;
+            segments[0].fileSize = fileSize;
+            segments[0].memorySize = fileSize;
+            segments[0].align = 0x1000;
+            // Nothing of it is in the file, so the loader maps anonymous zeroed pages.
+            segments[1].type = 1;
+            segments[1].flags = 6;
+            segments[1].offset = 0;
+            segments[1].virtualAddress = dataAddress;
+            segments[1].physicalAddress = dataAddress;
+            segments[1].fileSize = 0;
+            segments[1].memorySize = dataSize;
+            segments[1].align = 0x1000;
+
+            std::memcpy(image, &header, sizeof(header));
+            std::memcpy(image + sizeof(header), segments, segmentCount * sizeof(ProgramHeader));
+        }
+
+        void writeExecutable(const std::string& path) const {
+            std::vector<uint8_t> image = buildImage();
+            writeFile(path, image.data(), image.size(), 0755);
+        }
+
+    private:
+        struct ElfHeader {
+            uint8_t ident[16];
+            uint16_t type;
+            uint16_t machine;
+            uint32_t version;
+            uint64_t entry;
+            uint64_t programHeaderOffset;
+            uint64_t sectionHeaderOffset;
+            uint32_t flags;
+            uint16_t headerSize;
+            uint16_t programHeaderSize;
+            uint16_t programHeaderCount;
+            uint16_t sectionHeaderSize;
+            uint16_t sectionHeaderCount;
+            uint16_t sectionNameIndex;
+        };
+
+        struct ProgramHeader {
+            uint32_t type;
+            uint32_t flags;
+            uint64_t offset;
+            uint64_t virtualAddress;
+            uint64_t physicalAddress;
+            uint64_t fileSize;
+            uint64_t memorySize;
+            uint64_t align;
+        };
+
+        static_assert(sizeof(ElfHeader) == 64 && sizeof(ProgramHeader) == 56);
+
+        const std::vector<uint8_t>& code;
+        uint8_t osAbi;
+};
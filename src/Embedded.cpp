@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include "Diagnostics.cpp"
+#include "Parser.cpp"
+#include "Tokenization.cpp"
+
+// Helium snippets embedded in C++ and compiled along with it. helium::compile<"...">() lexes and
+// parses the snippet with the compiler's own lexToken and BasicParser during constant evaluation,
+// so nothing is parsed at run time, and an error in the snippet is an error in the C++ embedding it.
+// Identifiers read before any declaration are the snippet's parameters, in order of first use.
+namespace helium {
+
+    // String literal usable as a template argument.
+    template<size_t Size> struct FixedString {
+        char text[Size] {};
+
+        constexpr FixedString(const char (&literal)[Size]) {
+            std::copy(literal, literal + Size, text);
+        }
+
+        [[nodiscard]] constexpr std::string_view view() const {
+            return {text, Size - 1};
+        }
+    };
+
+    // Node arrays of fixed capacity, for programs built in constant evaluation.
+    template<size_t Capacity> struct Fixed {
+        template<typename T> class Array {
+            public:
+                [[nodiscard]] constexpr const T& operator[](size_t index) const {
+                    return elements[index];
+                }
+
+                constexpr T& operator[](size_t index) {
+                    return elements[index];
+                }
+
+                [[nodiscard]] constexpr const T* begin() const {
+                    return elements.data();
+                }
+
+                [[nodiscard]] constexpr const T* end() const {
+                    return elements.data() + count;
+                }
+
+                [[nodiscard]] constexpr size_t size() const {
+                    return count;
+                }
+
+                [[nodiscard]] constexpr bool empty() const {
+                    return count == 0;
+                }
+
+                constexpr void push_back(const T& element) {
+                    if (count == Capacity) {
+                        throw CompileError("Embedded program too large");
+                    }
+                    elements[count++] = element;
+                }
+
+                constexpr void reserve(size_t) {
+                }
+
+            private:
+                std::array<T, Capacity> elements {};
+                size_t count = 0;
+        };
+    };
+
+    template<size_t Capacity> using FixedProgram = BasicNodeProgram<Fixed<Capacity>::template Array>;
+
+    // Lexes `source` as Tokenizer does. Symbols are numbered by first appearance with a linear
+    // search instead of an Interner, which is fine for snippets.
+    template<size_t Capacity> constexpr typename Fixed<Capacity>::template Array<Token> tokenize(std::string_view source) {
+        typename Fixed<Capacity>::template Array<Token> tokens;
+        SymbolId symbolCount = 0;
+        const char* p = source.data();
+        while (std::optional<Token> token = lexToken(source, p)) {
+            if (token->type == TokenType::ident) {
+                token->symbol = symbolCount;
+                for (const Token& earlier: tokens) {
+                    if (earlier.type == TokenType::ident && earlier.text(source) == token->text(source)) {
+                        token->symbol = earlier.symbol;
+                        break;
+                    }
+                }
+                if (token->symbol == symbolCount) {
+                    symbolCount++;
+                }
+            }
+            tokens.push_back(token.value());
+        }
+        return tokens;
+    }
+
+    // Every node and every token takes at least one byte of source, so the length of the snippet
+    // bounds each array.
+    template<FixedString Source> constexpr FixedProgram<sizeof(Source.text)> parse() {
+        constexpr size_t capacity = sizeof(Source.text);
+        BasicParser<FixedProgram<capacity>> parser(tokenize<capacity>(Source.view()), Source.view());
+        return parser.parseProgram().value();
+    }
+
+    // A parsed snippet, called with one value per parameter. Evaluation is unrolled over the
+    // program at compile time, so each snippet becomes straight-line arithmetic on its arguments.
+    // Semantics match the interpreter: statements run in order, the first exit gives the result,
+    // 0 when there is none, and arithmetic wraps at 64 bits.
+    template<FixedString Source> class Snippet {
+        public:
+            static constexpr auto program = parse<Source>();
+
+        private:
+            static constexpr size_t capacity = sizeof(Source.text);
+
+            struct Parameters {
+                std::array<SymbolId, capacity> symbols {};
+                size_t count = 0;
+            };
+
+            static constexpr void collect(NodeIndex expr, const std::array<bool, capacity>& declared, Parameters& found) {
+                if (program.kinds[expr] == NodeKind::ident) {
+                    SymbolId symbol = program.symbol(expr);
+                    if (!declared[symbol] && std::find(found.symbols.begin(), found.symbols.begin() + found.count, symbol) == found.symbols.begin() + found.count) {
+                        found.symbols[found.count++] = symbol;
+                    }
+                } else if (NodeProgram::isBinary(program.kinds[expr])) {
+                    collect(program.lhs[expr], declared, found);
+                    collect(program.rhs[expr], declared, found);
+                }
+            }
+
+            static constexpr Parameters findParameters() {
+                Parameters found;
+                std::array<bool, capacity> declared {};
+                for (NodeIndex stmt: program.stmts) {
+                    collect(program.lhs[stmt], declared, found);
+                    if (program.kinds[stmt] == NodeKind::stmt_var) {
+                        if (declared[program.symbol(stmt)]) {
+                            throw CompileError("Identifier already used!" + std::string(program.text(stmt)));
+                        }
+                        declared[program.symbol(stmt)] = true;
+                    }
+                }
+                return found;
+            }
+
+            static constexpr Parameters parameters = findParameters();
+
+            using Values = std::array<uint64_t, std::max<size_t>(program.symbolCount, 1)>;
+
+            template<NodeIndex Expr> static constexpr uint64_t evaluate(const Values& values) {
+                constexpr NodeKind kind = program.kinds[Expr];
+                if constexpr (kind == NodeKind::int_lit) {
+                    return program.literalValue(Expr);
+                } else if constexpr (kind == NodeKind::ident) {
+                    return values[program.symbol(Expr)];
+                } else if constexpr (kind == NodeKind::add) {
+                    return evaluate<program.lhs[Expr]>(values) + evaluate<program.rhs[Expr]>(values);
+                } else {
+                    return evaluate<program.lhs[Expr]>(values) * evaluate<program.rhs[Expr]>(values);
+                }
+            }
+
+            template<size_t Stmt> static constexpr uint64_t run(Values& values) {
+                if constexpr (Stmt == program.stmts.size()) {
+                    return 0;
+                } else {
+                    constexpr NodeIndex stmt = program.stmts[Stmt];
+                    uint64_t value = evaluate<program.lhs[stmt]>(values);
+                    if constexpr (program.kinds[stmt] == NodeKind::stmt_exit) {
+                        return value;
+                    } else {
+                        values[program.symbol(stmt)] = value;
+                        return run<Stmt + 1>(values);
+                    }
+                }
+            }
+
+        public:
+            static constexpr size_t parameterCount = parameters.count;
+
+            template<std::convertible_to<uint64_t>... Arguments> requires (sizeof...(Arguments) == parameterCount)
+            constexpr uint64_t operator()(Arguments... arguments) const {
+                Values values {};
+                std::array<uint64_t, parameterCount> bound {static_cast<uint64_t>(arguments)...};
+                for (size_t i = 0; i < parameterCount; ++i) {
+                    values[parameters.symbols[i]] = bound[i];
+                }
+                return run<0>(values);
+            }
+    };
+
+    // The exit code of a snippet without parameters, folded at compile time, or a callable taking
+    // one uint64_t per parameter and returning the exit code.
+    template<FixedString Source> constexpr auto compile() {
+        if constexpr (Snippet<Source>::parameterCount == 0) {
+            return Snippet<Source>{}();
+        } else {
+            return Snippet<Source>{};
+        }
+    }
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Diagnostics.cpp"
+#include "MachineCode.cpp"
+
+// Encodes MachineProgram instructions as x86-64 machine code. Only the forms the Generator emits
+// are supported: 64 bit register, QWORD memory and immediate operands.
+class X86Encoder {
+    public:
+        [[nodiscard]] std::vector<uint8_t> encodeProgram(const MachineProgram& program) {
+            code.clear();
+            code.reserve(program.insts.size() * 5);
+            for (const MInst& inst: program.insts) {
+                encodeInst(inst);
+            }
+            return std::move(code);
+        }
+
+        void encodeInst(const MInst& inst) {
+            switch (inst.op) {
+                case MOp::mov:
+                    encodeMov(inst);
+                    break;
+                case MOp::add:
+                    // add r/m64, imm | add r/m64, r64 | add r64, r/m64
+                    encodeArithmetic(inst, 0, 0x01, 0x03);
+                    break;
+                case MOp::sub:
+                    encodeArithmetic(inst, 5, 0x29, 0x2B);
+                    break;
+                case MOp::imul:
+                    encodeImul(inst);
+                    break;
+                case MOp::lea:
+                    if (inst.kinds[0] != OperandKind::reg || inst.kinds[1] != OperandKind::mem) {
+                        unsupported(inst);
+                    }
+                    emitModRM(inst, {0x8D}, low(inst.regs[0]), inst.regs[0], inst.operand(1));
+                    break;
+                case MOp::shl:
+                    // shl r/m64, 1 | shl r/m64, imm8
+                    if (inst.kinds[1] != OperandKind::imm || inst.imm > 63) {
+                        unsupported(inst);
+                    }
+                    emitModRM(inst, {static_cast<uint8_t>(inst.imm == 1 ? 0xD1 : 0xC1)}, 4, Reg::rax, inst.operand(0));
+                    if (inst.imm != 1) {
+                        emitImm(inst.imm, 1);
+                    }
+                    break;
+                case MOp::push:
+                    emitRex(false, Reg::rax, inst.regs[0]);
+                    code.push_back(0x50 + low(inst.regs[0]));
+                    break;
+                case MOp::pop:
+                    emitRex(false, Reg::rax, inst.regs[0]);
+                    code.push_back(0x58 + low(inst.regs[0]));
+                    break;
+                case MOp::ret:
+                    code.push_back(0xC3);
+                    break;
+                case MOp::syscall:
+                    code.push_back(0x0F);
+                    code.push_back(0x05);
+                    break;
+            }
+        }
+
+        // Bytes encodeInst has appended since the last clearPendingCode, for encoding a program in pieces.
+        [[nodiscard]] const std::vector<uint8_t>& pendingCode() const {
+            return code;
+        }
+
+        void clearPendingCode() {
+            code.clear();
+        }
+
+        // Bytes `inst` encodes to, for comparing candidate sequences.
+        [[nodiscard]] size_t encodedSize(const MInst& inst) {
+            size_t start = code.size();
+            encodeInst(inst);
+            size_t size = code.size() - start;
+            code.resize(start);
+            return size;
+        }
+
+    private:
+        static bool fitsInt8(uint64_t imm) {
+            auto value = static_cast<int64_t>(imm);
+            return value >= INT8_MIN && value <= INT8_MAX;
+        }
+
+        static bool fitsInt32(uint64_t imm) {
+            auto value = static_cast<int64_t>(imm);
+            return value >= INT32_MIN && value <= INT32_MAX;
+        }
+
+        static uint8_t low(Reg reg) {
+            return static_cast<uint8_t>(reg) & 7;
+        }
+
+        static bool extended(Reg reg) {
+            return static_cast<uint8_t>(reg) >= 8;
+        }
+
+        void emitRex(bool wide, Reg reg, Reg rm, bool extendedIndex = false) {
+            uint8_t rex = 0x40 | (wide ? 0x08 : 0) | (extended(reg) ? 0x04 : 0) | (extendedIndex ? 0x02 : 0) | (extended(rm) ? 0x01 : 0);
+            if (rex != 0x40) {
+                code.push_back(rex);
+            }
+        }
+
+        void emitImm(uint64_t imm, int bytes) {
+            for (int i = 0; i < bytes; ++i) {
+                code.push_back(static_cast<uint8_t>(imm >> (8 * i)));
+            }
+        }
+
+        // Emits REX.W, the opcode bytes and a ModRM (plus SIB and displacement) addressing `rm`,
+        // which is a register or memory operand of `inst`.
+        void emitModRM(const MInst& inst, std::initializer_list<uint8_t> opcode, uint8_t regField, Reg regForRex, const MOperand& rm) {
+            bool indexed = rm.kind == OperandKind::mem && rm.scale != 0;
+            emitRex(true, regForRex, rm.reg, indexed && extended(rm.index));
+            for (uint8_t byte: opcode) {
+                code.push_back(byte);
+            }
+            uint8_t reg = (regField & 7) << 3;
+            if (rm.kind == OperandKind::reg) {
+                code.push_back(0xC0 | reg | low(rm.reg));
+                return;
+            }
+            // rbp and r13 as a base need an explicit displacement; rsp and r12 need a SIB byte.
+            uint8_t mod = 0x80;
+            if (inst.disp == 0 && low(rm.reg) != 5) {
+                mod = 0x00;
+            } else if (inst.disp >= INT8_MIN && inst.disp <= INT8_MAX) {
+                mod = 0x40;
+            }
+            if (indexed) {
+                uint8_t scaleBits = static_cast<uint8_t>(__builtin_ctz(rm.scale));
+                code.push_back(mod | reg | 4);
+                code.push_back(static_cast<uint8_t>(scaleBits << 6 | low(rm.index) << 3 | low(rm.reg)));
+            } else {
+                code.push_back(mod | reg | low(rm.reg));
+                if (low(rm.reg) == 4) {
+                    code.push_back(0x24);
+                }
+            }
+            if (mod == 0x40) {
+                emitImm(static_cast<uint64_t>(inst.disp), 1);
+            } else if (mod == 0x80) {
+                emitImm(static_cast<uint64_t>(inst.disp), 4);
+            }
+        }
+
+        void encodeMov(const MInst& inst) {
+            MOperand dest = inst.operand(0);
+            MOperand source = inst.operand(1);
+            if (source.kind == OperandKind::imm) {
+                if (dest.kind == OperandKind::reg && !fitsInt32(source.imm) && source.imm <= UINT32_MAX) {
+                    // mov r32, imm32 zero extends and is two bytes shorter than the sign-extended form.
+                    emitRex(false, Reg::rax, dest.reg);
+                    code.push_back(0xB8 + low(dest.reg));
+                    emitImm(source.imm, 4);
+                } else if (fitsInt32(source.imm)) {
+                    if (dest.kind == OperandKind::reg && source.imm <= INT32_MAX) {
+                        emitRex(false, Reg::rax, dest.reg);
+                        code.push_back(0xB8 + low(dest.reg));
+                    } else {
+                        emitModRM(inst, {0xC7}, 0, Reg::rax, dest);
+                    }
+                    emitImm(source.imm, 4);
+                } else if (dest.kind == OperandKind::reg) {
+                    emitRex(true, Reg::rax, dest.reg);
+                    code.push_back(0xB8 + low(dest.reg));
+                    emitImm(source.imm, 8);
+                } else {
+                    unsupported(inst);
+                }
+            } else if (source.kind == OperandKind::reg) {
+                emitModRM(inst, {0x89}, low(source.reg), source.reg, dest);
+            } else if (dest.kind == OperandKind::reg) {
+                emitModRM(inst, {0x8B}, low(dest.reg), dest.reg, source);
+            } else {
+                unsupported(inst);
+            }
+        }
+
+        void encodeArithmetic(const MInst& inst, uint8_t immExtension, uint8_t toRm, uint8_t fromRm) {
+            MOperand dest = inst.operand(0);
+            MOperand source = inst.operand(1);
+            if (source.kind == OperandKind::imm) {
+                if (fitsInt8(source.imm)) {
+                    emitModRM(inst, {0x83}, immExtension, Reg::rax, dest);
+                    emitImm(source.imm, 1);
+                } else if (fitsInt32(source.imm)) {
+                    emitModRM(inst, {0x81}, immExtension, Reg::rax, dest);
+                    emitImm(source.imm, 4);
+                } else {
+                    unsupported(inst);
+                }
+            } else if (source.kind == OperandKind::reg) {
+                emitModRM(inst, {toRm}, low(source.reg), source.reg, dest);
+            } else if (dest.kind == OperandKind::reg) {
+                emitModRM(inst, {fromRm}, low(dest.reg), dest.reg, source);
+            } else {
+                unsupported(inst);
+            }
+        }
+
+        void encodeImul(const MInst& inst) {
+            MOperand dest = inst.operand(0);
+            MOperand source = inst.operand(1);
+            if (dest.kind != OperandKind::reg) {
+                unsupported(inst);
+            }
+            if (inst.operandCount == 2) {
+                emitModRM(inst, {0x0F, 0xAF}, low(dest.reg), dest.reg, source);
+                return;
+            }
+            uint64_t imm = inst.operand(2).imm;
+            if (fitsInt8(imm)) {
+                emitModRM(inst, {0x6B}, low(dest.reg), dest.reg, source);
+                emitImm(imm, 1);
+            } else if (fitsInt32(imm)) {
+                emitModRM(inst, {0x69}, low(dest.reg), dest.reg, source);
+                emitImm(imm, 4);
+            } else {
+                unsupported(inst);
+            }
+        }
+
+        static void unsupported(const MInst& inst) {
+            throw CompileError("Unable to encode " + std::string(AsmWriter::mnemonic(inst.op)) + " with these operands");
+        }
+
+        std::vector<uint8_t> code;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Diagnostics.cpp"
+
+// Writes all `size` bytes at `data` to `fd`, carrying on after short writes; a single write on
+// Linux stops a little short of 2 GiB. Returns false on an error.
+inline bool writeAll(int fd, const void* data, size_t size) {
+    auto* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t count = write(fd, p, size);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        p += count;
+        size -= count;
+    }
+    return true;
+}
+
+// Creates or truncates `path` with permissions `mode` and writes `size` bytes at `data` to it. The
+// descriptor is closed on failure too, which matters in the long-lived compile server.
+inline void writeFile(const std::string& path, const void* data, size_t size, mode_t mode) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+    if (fd < 0) {
+        throw CompileError("Unable to write " + path);
+    }
+    bool written = writeAll(fd, data, size);
+    if (close(fd) != 0 || !written) {
+        throw CompileError("Unable to write " + path);
+    }
+}
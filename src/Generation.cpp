@@ -2,29 +2,38 @@
 #pragma ide diagnostic ignored "NotImplementedFunctions"
 #pragma once
 
-#include <sstream>
-#include "./Parser.cpp"
+#include <algorithm>
+#include <cassert>
+#include <unordered_map>
+#include <vector>
+#include "IR.cpp"
+#include "MachineCode.cpp"
+#include "RegisterAllocation.cpp"
+#include "Selection.cpp"
+#include "ThreadPool.cpp"
 
+// x86-64 backend. Consumes the IR, folds additions together with the single-use sums and scalings
+// feeding them, assigns every remaining SSA value a register or stack slot with linear scan and
+// produces a MachineProgram, leaving the choice of instructions to the InstructionSelector.
 class Generator {
     public:
-        inline explicit Generator(NodeProgram pRoot, const std::string& os): root(std::move(pRoot)) {
+        inline explicit Generator(const IRModule& pModule, const std::string& os): module(pModule) {
             if (os == "MacOS") {
-                main_name.assign("_main");
-                std::stringstream name;
-                name << "0x" << (2000000 + getBsdCall("exit"));
-                assign(exit_name, name);
+                program.entryName.assign("_main");
+                exitCall = 0x2000000 + getBsdCall("exit");
             } else if (os == "Linux") {
-                main_name.assign("_start");
+                program.entryName.assign("_start");
+                exitCall = getLinuxCall("exit");
             } else if (os == "BSD") {
-                main_name.assign("_start");
-                exit_name.assign(&"" [ getBsdCall("exit")]);
+                program.entryName.assign("_start");
+                exitCall = getBsdCall("exit");
             }
         }
 
-        static void assign(std::string& var, std::stringstream& stream) {
-            var.assign(stream.str());
-            stream.clear();
-            std::cerr << var;
+        // Generates a function to run in-process instead of a program entry point. Exit returns its
+        // value in rax, and the callee-saved registers the allocator hands out are preserved.
+        inline explicit Generator(const IRModule& pModule): module(pModule), returnOnExit(true) {
+            program.entryName.assign("helium_main");
         }
 
         [[nodiscard]] int getBsdCall(const std::string& name) const{
@@ -35,135 +44,447 @@ class Generator {
             return linuxCalls.at(name);
         }
 
-        void generateTerm(const NodeTerm* term) {
-            struct TermVisitor {
-                Generator* generator;
+        [[nodiscard]] MachineProgram generateProgram() {
+            fuseSums();
+            size_t generating = allocateRegisters();
+            CodeBuffer out;
+            out.insts.reserve(generating * 2);
+            generatePrologue(out);
+            for (const IRBlock* block: module.blocks) {
+                for (const IRInst* inst: block->insts) {
+                    generateInst(inst, out);
+                }
+            }
+            program.insts = std::move(out.insts);
+            return std::move(program);
+        }
+
+        // Generates on `pool`, with the same result as generateProgram(). Sums, registers and stack
+        // slots are settled for the whole program first; after that an instruction's code depends
+        // only on that fixed state, so the instructions are split into evenly sized runs, each
+        // generated into a buffer of its own, and the buffers are joined in program order.
+        [[nodiscard]] MachineProgram generateProgram(ThreadPool& pool) {
+            std::vector<Chunk> chunks = splitChunks(pool.size());
+            if (chunks.size() < 2) {
+                return generateProgram();
+            }
+            fuseSums();
+            allocateRegisters();
+            CodeBuffer out;
+            generatePrologue(out);
+            for (Chunk& chunk: chunks) {
+                pool.submit([this, &chunk] {
+                    generateChunk(chunk);
+                });
+            }
+            pool.wait();
+
+            size_t total = out.insts.size();
+            for (const Chunk& chunk: chunks) {
+                total += chunk.out.insts.size();
+            }
+            out.insts.reserve(total);
+            for (Chunk& chunk: chunks) {
+                out.insts.insert(out.insts.end(), chunk.out.insts.begin(), chunk.out.insts.end());
+                chunk.out.insts = {};
+            }
+            program.insts = std::move(out.insts);
+            return std::move(program);
+        }
+
+    private:
+
+        // r11 is kept out of allocation so there is always a register for memory to memory moves.
+        static constexpr Reg scratch = Reg::r11;
+        static constexpr RegSet allocatableRegs = RegSet::of({
+            Reg::rax, Reg::rcx, Reg::rdx, Reg::rbx, Reg::rbp, Reg::rsi, Reg::rdi,
+            Reg::r8, Reg::r9, Reg::r10, Reg::r12, Reg::r13, Reg::r14, Reg::r15
+        });
+
+        static constexpr RegSet calleeSavedRegs = RegSet::of({
+            Reg::rbx, Reg::rbp, Reg::r12, Reg::r13, Reg::r14, Reg::r15
+        });
+
+        // Fewer instructions than this per chunk cost more in handing out work than they save.
+        static constexpr size_t minChunkInsts = 64 * 1024;
+
+        // Instructions generated for a run of the program, and the selector that chose them.
+        struct CodeBuffer {
+            std::vector<MInst> insts;
+            InstructionSelector selector {scratch};
+        };
+
+        // `count` instructions starting at instruction `inst` of block `block`, running on across
+        // block boundaries.
+        struct Chunk {
+            size_t block = 0;
+            size_t inst = 0;
+            size_t count = 0;
+            CodeBuffer out;
+        };
+
+        // A sum of at most two values, one of them scaled by 2, 4 or 8, and a constant: the most an
+        // add can cover and still be a single lea.
+        struct Sum {
+            const IRInst* terms[2] {};
+            int32_t disp = 0;
+            uint8_t scales[2] {};
+            uint8_t termCount = 0;
 
-                void operator()(const NodeTermIntLit* intLitTerm) const {
-                    generator->output << "    mov rax, " << intLitTerm->int_lit.value.value() << "\n";
-                    generator->push("rax");
+            [[nodiscard]] bool fits(const Sum& other) const {
+                int scaled = 0;
+                for (int i = 0; i < termCount; ++i) {
+                    scaled += scales[i] > 1;
                 }
+                for (int i = 0; i < other.termCount; ++i) {
+                    scaled += other.scales[i] > 1;
+                }
+                int64_t total = static_cast<int64_t>(disp) + other.disp;
+                return termCount + other.termCount <= 2 && scaled <= 1 && total >= INT32_MIN && total <= INT32_MAX;
+            }
 
-                void operator()(const NodeTermIdent* identTerm) const {
-                    if (!generator->vars.contains(identTerm->ident.value.value())) {
-                        std::cerr << "Undeclared identifier: " << identTerm->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    const auto& var = generator->vars.at(identTerm->ident.value.value());
-                    std::stringstream offset;
-                    offset << "QWORD [rsp + " << (generator->stackSize -var.stackLocation - 1) * 8 << "]";
-                    generator->push(offset.str());
+            [[nodiscard]] static Sum plain(const IRInst* value) {
+                Sum sum;
+                sum.terms[0] = value;
+                sum.scales[0] = 1;
+                sum.termCount = 1;
+                return sum;
+            }
+
+            void absorb(const Sum& other) {
+                assert(fits(other));
+                for (int i = 0; i < other.termCount; ++i) {
+                    terms[termCount] = other.terms[i];
+                    scales[termCount++] = other.scales[i];
                 }
-            };
-
-            TermVisitor visitor{.generator = this};
-            std::visit(visitor, term->var);
-        }
-
-        void generateBinaryExpr(const NodeBinExpr* binExpr) {
-            struct BinExprVisitor{
-                Generator* generator;
-                void operator()(const NodeBinExprAdd* add) const {
-                    generator->generateExpr(add->lhs);
-                    generator->generateExpr(add->rhs);
-                    generator->pop("rax");
-                    generator->pop("rbx");
-                    generator->output << "    add rax, rbx\n";
-                    generator->push("rax");
+                disp += other.disp;
+            }
+        };
+
+        // Gives every add its Sum, absorbing operands used nowhere else: an add, whose own Sum is
+        // taken over, a multiplication by 2, 4 or 8, which becomes a scaled term, and constants.
+        // The absorbed instructions are covered and generate no code.
+        void fuseSums() {
+            // Saturates at 2; only whether a value has a single use matters.
+            std::vector<uint8_t> uses(module.valueCount(), 0);
+            for (const IRBlock* block: module.blocks) {
+                for (const IRInst* inst: block->insts) {
+                    for (int i = 0; i < inst->operandCount(); ++i) {
+                        uint8_t& count = uses[inst->operands[i]->id];
+                        count = count < 2 ? count + 1 : 2;
+                    }
                 }
-                void operator()(const NodeBinExprMulti* multi) const {
-                    generator->generateExpr(multi->lhs);
-                    generator->generateExpr(multi->rhs);
-                    generator->pop("rax");
-                    generator->pop("rbx");
-                    generator->output << "    mul rbx\n";
-                    generator->push("rax");
+            }
+            sums.clear();
+            sums.reserve(module.valueCount() / 2);
+            sumOf.assign(module.valueCount(), 0);
+            covered.assign(module.valueCount(), false);
+            for (const IRBlock* block: module.blocks) {
+                for (const IRInst* inst: block->insts) {
+                    if (inst->op != IROp::add) {
+                        continue;
+                    }
+                    sumOf[inst->id] = static_cast<uint32_t>(sums.size());
+                    Sum& sum = sums.emplace_back();
+                    for (const IRInst* operand: inst->operands) {
+                        Sum term;
+                        bool foldable = true;
+                        if (isImmediate(operand)) {
+                            term.disp = static_cast<int32_t>(operand->imm);
+                        } else if (uses[operand->id] == 1 && operand->op == IROp::add) {
+                            term = sums[sumOf[operand->id]];
+                        } else if (uses[operand->id] == 1 && operand->op == IROp::mul && scaleOf(operand) != 0) {
+                            const IRInst* scaled = isImmediate(operand->operands[0]) ? operand->operands[1] : operand->operands[0];
+                            term.terms[0] = scaled;
+                            term.scales[0] = scaleOf(operand);
+                            term.termCount = 1;
+                        } else {
+                            foldable = false;
+                        }
+                        if (foldable && sum.fits(term)) {
+                            sum.absorb(term);
+                            if (!isImmediate(operand)) {
+                                covered[operand->id] = true;
+                            }
+                        } else if (sum.fits(Sum::plain(operand))) {
+                            sum.absorb(Sum::plain(operand));
+                        } else {
+                            // The first operand's Sum took both terms, leaving none for this one,
+                            // so the first is computed on its own after all.
+                            const IRInst* first = inst->operands[0];
+                            covered[first->id] = false;
+                            sum = Sum::plain(first);
+                            sum.absorb(Sum::plain(operand));
+                        }
+                    }
                 }
-            };
-            BinExprVisitor visitor({.generator = this});
-            std::visit(visitor, binExpr->var);
+            }
         }
 
-        void generateExpr(const NodeExpr* expr) {
-            struct ExprVisitor {
-                Generator* generator;
+        // 2, 4 or 8 for a multiplication of a value by that constant, otherwise 0.
+        [[nodiscard]] static uint8_t scaleOf(const IRInst* mul) {
+            const IRInst* lhs = mul->operands[0];
+            const IRInst* rhs = mul->operands[1];
+            const IRInst* factor = isImmediate(rhs) ? rhs : lhs;
+            if (!isImmediate(factor) || (isImmediate(lhs) && isImmediate(rhs))) {
+                return 0;
+            }
+            return factor->imm == 2 || factor->imm == 4 || factor->imm == 8 ? static_cast<uint8_t>(factor->imm) : 0;
+        }
 
-                void operator()(const NodeTerm* term) const {
-                    generator->generateTerm(term);
+        // Values the instruction reads: the terms of its Sum for an add.
+        template<typename Visit> void forEachUse(const IRInst* inst, Visit visit) const {
+            if (inst->op == IROp::add) {
+                const Sum& sum = sums[sumOf[inst->id]];
+                for (int i = 0; i < sum.termCount; ++i) {
+                    visit(sum.terms[i]);
                 }
+                return;
+            }
+            for (int i = 0; i < inst->operandCount(); ++i) {
+                visit(inst->operands[i]);
+            }
+        }
 
-                void operator()(const NodeBinExpr* binExpr) const {
-                    generator->generateBinaryExpr(binExpr);
+        // Numbers the instructions in program order and gives every value that is not used as an
+        // immediate or covered a live interval from its definition to its last use. Returns how
+        // many instructions were numbered, the ones that generate code.
+        size_t allocateRegisters() {
+            std::vector<size_t> intervalOf(module.valueCount(), SIZE_MAX);
+            std::vector<LiveInterval> intervals;
+            std::vector<uint32_t> valueOf;
+            size_t position = 0;
+            for (const IRBlock* block: module.blocks) {
+                for (const IRInst* inst: block->insts) {
+                    if (inst->type != IRType::none && covered[inst->id]) {
+                        continue;
+                    }
+                    forEachUse(inst, [&](const IRInst* value) {
+                        size_t interval = intervalOf[value->id];
+                        if (interval != SIZE_MAX) {
+                            intervals[interval].end = position;
+                        }
+                    });
+                    if (inst->type != IRType::none && !isImmediate(inst)) {
+                        intervalOf[inst->id] = intervals.size();
+                        intervals.push_back({.start = position, .end = position});
+                        valueOf.push_back(inst->id);
+                    }
+                    position++;
                 }
-            };
+            }
+
+            LinearScanAllocator allocator(allocatableRegs);
+            frameSlots = allocator.allocate(intervals);
+            locations.assign(module.valueCount(), Location::inReg(scratch));
+            for (size_t i = 0; i < intervals.size(); ++i) {
+                locations[valueOf[i]] = intervals[i].location;
+                if (!intervals[i].location.spilled) {
+                    usedRegs.add(intervals[i].location.reg);
+                }
+            }
+            return position;
+        }
 
-            ExprVisitor visitor{.generator = this};
-            std::visit(visitor, expr->var);
+        // Saves the callee-saved registers handed out when returning on exit and makes room for
+        // the spill slots.
+        void generatePrologue(CodeBuffer& out) {
+            if (returnOnExit) {
+                for (RegSet saved = usedRegs & calleeSavedRegs; !saved.empty();) {
+                    savedRegs.push_back(saved.take());
+                    emit(out, MOp::push, {MOperand::ofReg(savedRegs.back())});
+                }
+            }
+            if (frameSlots > 0) {
+                emit(out, MOp::sub, {MOperand::ofReg(Reg::rsp), MOperand::ofImm(frameSlots * 8)});
+            }
         }
 
-        void generateStmt(const NodeStmt* stmt) {
-            struct StmtVisitor {
-                Generator* generator;
+        // Evenly sized chunks, one per worker while each gets at least minChunkInsts instructions.
+        [[nodiscard]] std::vector<Chunk> splitChunks(size_t chunkCount) const {
+            size_t total = 0;
+            for (const IRBlock* block: module.blocks) {
+                total += block->insts.size();
+            }
+            chunkCount = std::min(chunkCount, total / minChunkInsts);
+            std::vector<Chunk> chunks(chunkCount);
+            size_t block = 0;
+            size_t blockStart = 0;
+            for (size_t i = 0; i < chunkCount; ++i) {
+                size_t begin = total * i / chunkCount;
+                while (begin - blockStart >= module.blocks[block]->insts.size()) {
+                    blockStart += module.blocks[block++]->insts.size();
+                }
+                chunks[i].block = block;
+                chunks[i].inst = begin - blockStart;
+                chunks[i].count = total * (i + 1) / chunkCount - begin;
+            }
+            return chunks;
+        }
 
-                void operator ()(const NodeStmtExit* exitStmt) const {
-                    generator->generateExpr(exitStmt->expr);
-                    generator->output << "    mov rax, " << generator->exit_name << "\n";
-                    generator->pop("rdi");
-                    generator->output << "    syscall\n";
+        void generateChunk(Chunk& chunk) const {
+            chunk.out.insts.reserve(chunk.count * 2);
+            size_t inst = chunk.inst;
+            for (size_t block = chunk.block, left = chunk.count; left > 0; ++block, inst = 0) {
+                const std::vector<IRInst*>& insts = module.blocks[block]->insts;
+                for (; inst < insts.size() && left > 0; ++inst, --left) {
+                    generateInst(insts[inst], chunk.out);
                 }
+            }
+        }
 
-                void operator ()(const NodeStmtVar* varStmt) const {
-                    if (generator->vars.contains(varStmt->ident.value.value())) {
-                        std::cerr << "Identifier already used!" << varStmt->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
+        void generateInst(const IRInst* inst, CodeBuffer& out) const {
+            switch (inst->op) {
+                case IROp::constant:
+                    if (!isImmediate(inst)) {
+                        move(out, locations[inst->id], MOperand::ofImm(inst->imm));
+                    }
+                    break;
+                case IROp::copy:
+                    move(out, locations[inst->id], operand(inst->operands[0]));
+                    break;
+                case IROp::add:
+                    if (!covered[inst->id]) {
+                        generateSum(inst, out);
                     }
+                    break;
+                case IROp::mul:
+                    if (!covered[inst->id]) {
+                        generateProduct(inst, out);
+                    }
+                    break;
+                case IROp::exit:
+                    if (returnOnExit) {
+                        generateReturn(inst, out);
+                        break;
+                    }
+                    emit(out, MOp::mov, {MOperand::ofReg(Reg::rdi), operand(inst->operands[0])});
+                    emit(out, MOp::mov, {MOperand::ofReg(Reg::rax), MOperand::ofImm(exitCall)});
+                    emit(out, MOp::syscall, {});
+                    break;
+            }
+        }
 
-                    generator->vars.insert({varStmt->ident.value.value(), Var{.stackLocation = generator->stackSize}});
-                    generator->generateExpr(varStmt->expr);
+        // Computes the add's Sum in its location, or in the scratch register first when that is
+        // memory. A scaled term becomes the index.
+        void generateSum(const IRInst* inst, CodeBuffer& out) const {
+            const Sum& sum = sums[sumOf[inst->id]];
+            InstructionSelector::Sum selected;
+            selected.disp = sum.disp;
+            for (int i = 0; i < sum.termCount; ++i) {
+                bool asIndex = sum.scales[i] > 1 || (i == 1 && sum.scales[0] == 1);
+                (asIndex ? selected.index : selected.base) = operand(sum.terms[i]);
+                if (asIndex) {
+                    selected.scale = sum.scales[i];
                 }
-            };
-
-            StmtVisitor visitor{.generator = this};
-            std::visit(visitor, stmt->var);
+            }
+            emitSelected(out, locationOperand(locations[inst->id]), [&](Reg target) {
+                return out.selector.selectSum(target, selected);
+            });
         }
 
+        // Multiplications by a constant go through the selector; otherwise two operand imul, where
+        // the destination doubles as the left operand and the operands swap when the destination
+        // already holds the right one.
+        void generateProduct(const IRInst* inst, CodeBuffer& out) const {
+            MOperand lhs = operand(inst->operands[0]);
+            MOperand rhs = operand(inst->operands[1]);
+            MOperand dest = locationOperand(locations[inst->id]);
+            if (lhs.kind == OperandKind::imm && rhs.kind != OperandKind::imm) {
+                std::swap(lhs, rhs);
+            }
+            if (rhs.kind == OperandKind::imm) {
+                emitSelected(out, dest, [&](Reg target) {
+                    return out.selector.selectMultiply(target, lhs, rhs.imm);
+                });
+                return;
+            }
+            if (dest.kind == OperandKind::mem) {
+                emit(out, MOp::mov, {MOperand::ofReg(scratch), lhs});
+                emit(out, MOp::imul, {MOperand::ofReg(scratch), rhs});
+                emit(out, MOp::mov, {dest, MOperand::ofReg(scratch)});
+                return;
+            }
+            if (rhs == dest && lhs != dest) {
+                std::swap(lhs, rhs);
+            }
+            if (lhs != dest) {
+                emit(out, MOp::mov, {dest, lhs});
+            }
+            emit(out, MOp::imul, {dest, rhs});
+        }
 
-        [[nodiscard]] std::string generateProgram() {
-            output << "global " << main_name << "\n" << main_name << ":\n";
+        void generateReturn(const IRInst* inst, CodeBuffer& out) const {
+            move(out, Location::inReg(Reg::rax), operand(inst->operands[0]));
+            if (frameSlots > 0) {
+                emit(out, MOp::add, {MOperand::ofReg(Reg::rsp), MOperand::ofImm(frameSlots * 8)});
+            }
+            for (auto reg = savedRegs.rbegin(); reg != savedRegs.rend(); ++reg) {
+                emit(out, MOp::pop, {MOperand::ofReg(*reg)});
+            }
+            emit(out, MOp::ret, {});
+        }
 
-            for (const NodeStmt* stmt: root.stmts) {
-                generateStmt(stmt);
+        // Emits the selected sequence for a register destination, or computes into the scratch
+        // register and stores it for a memory one.
+        template<typename Select> static void emitSelected(CodeBuffer& out, const MOperand& dest, Select select) {
+            Reg target = dest.kind == OperandKind::reg ? dest.reg : scratch;
+            for (const MInst& inst: select(target)) {
+                out.insts.push_back(inst);
             }
+            if (dest.kind == OperandKind::mem) {
+                emit(out, MOp::mov, {dest, MOperand::ofReg(scratch)});
+            }
+        }
 
-            output << "    mov rax, " << exit_name << "\n";
-            output << "    mov rdi, 0\n";
-            output << "    syscall\n";
-            return output.str();
+        // Memory destinations cannot take another memory operand or a 64 bit immediate directly.
+        static void move(CodeBuffer& out, const Location& location, const MOperand& source) {
+            MOperand dest = locationOperand(location);
+            bool wideImmediate = source.kind == OperandKind::imm && source.imm > INT32_MAX;
+            if (dest.kind == OperandKind::mem && (source.kind == OperandKind::mem || wideImmediate)) {
+                emit(out, MOp::mov, {MOperand::ofReg(scratch), source});
+                emit(out, MOp::mov, {dest, MOperand::ofReg(scratch)});
+            } else if (dest != source) {
+                emit(out, MOp::mov, {dest, source});
+            }
         }
 
-    private:
+        static void emit(CodeBuffer& out, MOp op, std::initializer_list<MOperand> operands) {
+            out.insts.push_back(MInst::make(op, operands));
+        }
 
-        void push(const std::string& reg) {
-            output << "    push " << reg << "\n";
-            stackSize++;
+        // Constants that fit a sign-extended imm32 are never materialized; every use takes them as
+        // an immediate operand.
+        [[nodiscard]] static bool isImmediate(const IRInst* value) {
+            return value->op == IROp::constant && value->imm <= INT32_MAX;
         }
 
-        void pop(const std::string& reg) {
-            output << "    pop " << reg << "\n";
-            stackSize--;
+        [[nodiscard]] MOperand operand(const IRInst* value) const {
+            if (isImmediate(value)) {
+                return MOperand::ofImm(value->imm);
+            }
+            return locationOperand(locations[value->id]);
         }
 
-        struct Var {
-            size_t stackLocation;
-        };
+        [[nodiscard]] static MOperand locationOperand(const Location& location) {
+            if (location.spilled) {
+                return MOperand::ofMem(Reg::rsp, static_cast<int32_t>(location.slot * 8));
+            }
+            return MOperand::ofReg(location.reg);
+        }
 
-        const NodeProgram root;
-        //TODO: make these not hardcoded for other OSs
-        std::string main_name;
-        std::stringstream output;
-        std::string exit_name;
-        size_t stackSize = 0;
-        std::unordered_map<std::string, Var> vars {};
+        const IRModule& module;
+        MachineProgram program;
+        // The Sum of every add, in program order, and its index by value id.
+        std::vector<Sum> sums {};
+        std::vector<uint32_t> sumOf {};
+        std::vector<bool> covered {};
+        uint64_t exitCall = 0;
+        bool returnOnExit = false;
+        uint32_t frameSlots = 0;
+        RegSet usedRegs {};
+        std::vector<Reg> savedRegs {};
+        std::vector<Location> locations {};
         std::unordered_map<std::string, int> bsdCalls {{"exit", 1}};
         std::unordered_map<std::string, int> linuxCalls {{"exit", 60}};
-};
\ No newline at end of file
+};
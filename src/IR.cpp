@@ -0,0 +1,250 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Arena.cpp"
+#include "Diagnostics.cpp"
+#include "Parser.cpp"
+#include "Symbols.cpp"
+
+// SSA intermediate representation between the AST and the x86 backend. Every instruction that
+// produces a value defines exactly one SSA value, numbered by `id`. Helium has no assignment, so
+// every variable is defined once and no phi nodes are needed; a `var` declaration lowers to a
+// copy that names the value, which copy propagation later removes.
+enum class IROp : uint8_t {
+    constant,
+    copy,
+    add,
+    mul,
+    exit
+};
+
+enum class IRType : uint8_t {
+    none,
+    i64
+};
+
+struct IRBlock;
+
+struct IRInst {
+    IROp op;
+    IRType type;
+    uint32_t id;
+    IRInst* operands[2];
+    uint64_t imm;
+    // Source name of the variable a copy binds, for dumps only.
+    std::string_view name;
+
+    [[nodiscard]] int operandCount() const {
+        switch (op) {
+            case IROp::constant:
+                return 0;
+            case IROp::copy:
+            case IROp::exit:
+                return 1;
+            default:
+                return 2;
+        }
+    }
+
+    [[nodiscard]] bool isTerminator() const {
+        return op == IROp::exit;
+    }
+
+    [[nodiscard]] bool isCommutative() const {
+        return op == IROp::add || op == IROp::mul;
+    }
+};
+
+struct IRBlock {
+    uint32_t id;
+    std::vector<IRInst*> insts;
+
+    [[nodiscard]] bool isTerminated() const {
+        return !insts.empty() && insts.back()->isTerminator();
+    }
+
+    // Blocks only end in exit so far, which never falls through.
+    [[nodiscard]] std::vector<IRBlock*> successors() const {
+        return {};
+    }
+};
+
+// A whole program: the entry block comes first. Instructions and blocks live in the module's arena.
+class IRModule {
+    public:
+        IRModule(): ownedArena(std::make_unique<ArenaAllocator>()), arena(*ownedArena) {
+        }
+
+        // Allocates from `pArena` instead, so a caller compiling many programs can reuse one arena.
+        // The arena must outlive the module.
+        inline explicit IRModule(ArenaAllocator& pArena): arena(pArena) {
+        }
+
+        IRModule(const IRModule& other) = delete;
+
+        IRModule& operator=(const IRModule& other) = delete;
+
+        IRBlock* addBlock() {
+            auto block = arena.alloc<IRBlock>();
+            block->id = nextBlockId++;
+            blocks.push_back(block);
+            return block;
+        }
+
+        IRInst* create(IROp op, IRInst* lhs = nullptr, IRInst* rhs = nullptr, uint64_t imm = 0) {
+            auto inst = arena.alloc<IRInst>();
+            inst->op = op;
+            inst->type = op == IROp::exit ? IRType::none : IRType::i64;
+            inst->id = inst->type == IRType::none ? 0 : nextValueId++;
+            inst->operands[0] = lhs;
+            inst->operands[1] = rhs;
+            inst->imm = imm;
+            return inst;
+        }
+
+        [[nodiscard]] uint32_t valueCount() const {
+            return nextValueId;
+        }
+
+        [[nodiscard]] ArenaAllocator::Stats arenaStats() const {
+            return arena.stats();
+        }
+
+        std::vector<IRBlock*> blocks;
+
+    private:
+        std::unique_ptr<ArenaAllocator> ownedArena;
+        ArenaAllocator& arena;
+        uint32_t nextBlockId = 0;
+        uint32_t nextValueId = 0;
+};
+
+// Lowers a NodeProgram into a module. Identifier resolution happens here, so the undeclared and
+// redeclared identifier errors are reported by this pass.
+class IRLowering {
+    public:
+        inline explicit IRLowering(IRModule& pModule, const NodeProgram& pRoot): module(pModule), root(pRoot), vars(pRoot.symbolCount) {
+        }
+
+        void lowerProgram() {
+            block = module.addBlock();
+            for (NodeIndex stmt: root.stmts) {
+                lowerStmt(stmt);
+            }
+            if (!block->isTerminated()) {
+                emit(module.create(IROp::exit, emit(module.create(IROp::constant, nullptr, nullptr, 0))));
+            }
+        }
+
+    private:
+        void lowerStmt(NodeIndex stmt) {
+            // Anything after an exit is unreachable, but it still has to be checked and lowered.
+            if (block->isTerminated()) {
+                block = module.addBlock();
+            }
+            if (root.kinds[stmt] == NodeKind::stmt_exit) {
+                emit(module.create(IROp::exit, lowerExpr(root.lhs[stmt])));
+                return;
+            }
+            IRInst* value = lowerExpr(root.lhs[stmt]);
+            std::string_view name = root.text(stmt);
+            if (vars.find(root.symbol(stmt)) != nullptr) {
+                throw CompileError("Identifier already used!" + std::string(name));
+            }
+            IRInst* copy = emit(module.create(IROp::copy, value));
+            copy->name = name;
+            vars.declare(root.symbol(stmt), copy);
+        }
+
+        IRInst* lowerExpr(NodeIndex expr) {
+            switch (root.kinds[expr]) {
+                case NodeKind::int_lit:
+                    return emit(module.create(IROp::constant, nullptr, nullptr, root.literalValue(expr)));
+                case NodeKind::ident: {
+                    IRInst** found = vars.find(root.symbol(expr));
+                    if (found == nullptr) {
+                        throw CompileError("Undeclared identifier: " + std::string(root.text(expr)));
+                    }
+                    return *found;
+                }
+                default: {
+                    IROp op = root.kinds[expr] == NodeKind::add ? IROp::add : IROp::mul;
+                    IRInst* lhs = lowerExpr(root.lhs[expr]);
+                    IRInst* rhs = lowerExpr(root.rhs[expr]);
+                    return emit(module.create(op, lhs, rhs));
+                }
+            }
+        }
+
+        IRInst* emit(IRInst* inst) {
+            block->insts.push_back(inst);
+            return inst;
+        }
+
+        IRModule& module;
+        const NodeProgram& root;
+        IRBlock* block = nullptr;
+        SymbolTable<IRInst*> vars;
+};
+
+class IRPrinter {
+    public:
+        inline explicit IRPrinter(const IRModule& pModule): module(pModule) {
+        }
+
+        [[nodiscard]] std::string printModule() {
+            for (const IRBlock* block: module.blocks) {
+                output << "bb" << block->id << ":\n";
+                for (const IRInst* inst: block->insts) {
+                    printInst(inst);
+                }
+            }
+            return output.str();
+        }
+
+    private:
+        void printInst(const IRInst* inst) {
+            output << "    ";
+            if (inst->type != IRType::none) {
+                output << "%" << inst->id << " = ";
+            }
+            output << opName(inst->op);
+            if (inst->type != IRType::none) {
+                output << " i64";
+            }
+            if (inst->op == IROp::constant) {
+                output << " " << inst->imm;
+            }
+            for (int i = 0; i < inst->operandCount(); ++i) {
+                output << (i == 0 ? " " : ", ") << "%" << inst->operands[i]->id;
+            }
+            if (!inst->name.empty()) {
+                output << "    ; " << inst->name;
+            }
+            output << "\n";
+        }
+
+        static const char* opName(IROp op) {
+            switch (op) {
+                case IROp::constant:
+                    return "const";
+                case IROp::copy:
+                    return "copy";
+                case IROp::add:
+                    return "add";
+                case IROp::mul:
+                    return "mul";
+                case IROp::exit:
+                    return "exit";
+            }
+            return "?";
+        }
+
+        const IRModule& module;
+        std::stringstream output;
+};
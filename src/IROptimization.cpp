@@ -0,0 +1,178 @@
+#pragma once
+
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "IR.cpp"
+
+// Scalar optimizations over the SSA IR. Each pass returns whether it changed anything.
+class IROptimizer {
+    public:
+        inline explicit IROptimizer(IRModule& pModule): module(pModule) {
+        }
+
+        void optimizeModule() {
+            removeUnreachableBlocks();
+            bool changed = true;
+            while (changed) {
+                changed = propagateCopies();
+                changed |= eliminateCommonSubexpressions();
+                changed |= eliminateDeadCode();
+            }
+        }
+
+        // Rewrites every use of a copy to use the copied value directly. The copies themselves are
+        // left for dead code elimination.
+        bool propagateCopies() {
+            bool changed = false;
+            forEachInst([&](IRInst* inst) {
+                for (int i = 0; i < inst->operandCount(); ++i) {
+                    IRInst* source = inst->operands[i];
+                    while (source->op == IROp::copy) {
+                        source = source->operands[0];
+                    }
+                    if (source != inst->operands[i]) {
+                        inst->operands[i] = source;
+                        changed = true;
+                    }
+                }
+            });
+            return changed;
+        }
+
+        // Local value numbering: an instruction that computes the same operation on the same operands
+        // as an earlier one in its block is replaced by that earlier instruction. Operands of
+        // commutative operations are put in a canonical order first.
+        bool eliminateCommonSubexpressions() {
+            bool changed = false;
+            std::unordered_map<IRInst*, IRInst*> replacements;
+            for (IRBlock* block: module.blocks) {
+                std::unordered_map<ValueKey, IRInst*, ValueKeyHash> available;
+                for (IRInst* inst: block->insts) {
+                    for (int i = 0; i < inst->operandCount(); ++i) {
+                        auto found = replacements.find(inst->operands[i]);
+                        if (found != replacements.end()) {
+                            inst->operands[i] = found->second;
+                        }
+                    }
+                    if (inst->op == IROp::copy || inst->type == IRType::none) {
+                        continue;
+                    }
+                    ValueKey key = keyOf(inst);
+                    auto [existing, inserted] = available.insert({key, inst});
+                    if (!inserted) {
+                        replacements.insert({inst, existing->second});
+                        changed = true;
+                    }
+                }
+            }
+            return changed;
+        }
+
+        // Removes every instruction whose value is never used by an instruction with side effects,
+        // directly or through other instructions.
+        bool eliminateDeadCode() {
+            std::vector<bool> live(module.valueCount(), false);
+            std::vector<IRInst*> worklist;
+            forEachInst([&](IRInst* inst) {
+                if (inst->type == IRType::none) {
+                    worklist.push_back(inst);
+                }
+            });
+            while (!worklist.empty()) {
+                IRInst* inst = worklist.back();
+                worklist.pop_back();
+                for (int i = 0; i < inst->operandCount(); ++i) {
+                    IRInst* operand = inst->operands[i];
+                    if (!live[operand->id]) {
+                        live[operand->id] = true;
+                        worklist.push_back(operand);
+                    }
+                }
+            }
+
+            bool changed = false;
+            for (IRBlock* block: module.blocks) {
+                size_t before = block->insts.size();
+                std::erase_if(block->insts, [&](const IRInst* inst) {
+                    return inst->type != IRType::none && !live[inst->id];
+                });
+                changed |= block->insts.size() != before;
+            }
+            return changed;
+        }
+
+        bool removeUnreachableBlocks() {
+            if (module.blocks.empty()) {
+                return false;
+            }
+            std::vector<IRBlock*> worklist {module.blocks.front()};
+            std::vector<bool> reachable(module.blocks.size(), false);
+            reachable[0] = true;
+            std::unordered_map<const IRBlock*, size_t> indexOf;
+            for (size_t i = 0; i < module.blocks.size(); ++i) {
+                indexOf.insert({module.blocks[i], i});
+            }
+            while (!worklist.empty()) {
+                IRBlock* block = worklist.back();
+                worklist.pop_back();
+                for (IRBlock* successor: block->successors()) {
+                    size_t index = indexOf.at(successor);
+                    if (!reachable[index]) {
+                        reachable[index] = true;
+                        worklist.push_back(successor);
+                    }
+                }
+            }
+            size_t index = 0;
+            size_t before = module.blocks.size();
+            std::erase_if(module.blocks, [&](const IRBlock*) {
+                return !reachable[index++];
+            });
+            return module.blocks.size() != before;
+        }
+
+    private:
+        struct ValueKey {
+            IROp op;
+            uint32_t lhs;
+            uint32_t rhs;
+            uint64_t imm;
+
+            bool operator==(const ValueKey& other) const = default;
+        };
+
+        struct ValueKeyHash {
+            size_t operator()(const ValueKey& key) const {
+                uint64_t hash = static_cast<uint64_t>(key.op);
+                hash = hash * 0x9E3779B97F4A7C15ull ^ key.lhs;
+                hash = hash * 0x9E3779B97F4A7C15ull ^ key.rhs;
+                hash = hash * 0x9E3779B97F4A7C15ull ^ key.imm;
+                return hash;
+            }
+        };
+
+        static ValueKey keyOf(const IRInst* inst) {
+            ValueKey key {.op = inst->op, .lhs = UINT32_MAX, .rhs = UINT32_MAX, .imm = inst->imm};
+            if (inst->operandCount() > 0) {
+                key.lhs = inst->operands[0]->id;
+            }
+            if (inst->operandCount() > 1) {
+                key.rhs = inst->operands[1]->id;
+            }
+            if (inst->isCommutative() && key.lhs > key.rhs) {
+                std::swap(key.lhs, key.rhs);
+            }
+            return key;
+        }
+
+        template<typename Callback> void forEachInst(const Callback& callback) {
+            for (IRBlock* block: module.blocks) {
+                for (IRInst* inst: block->insts) {
+                    callback(inst);
+                }
+            }
+        }
+
+        IRModule& module;
+};
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <sys/resource.h>
+
+// Scoped phase timers and counters for --time-passes and --trace. Disabled instrumentation records
+// nothing. Phases and counters from any number of threads can be recorded at once; when the object
+// goes away it prints the summary table and writes the Chrome trace, if either was asked for.
+class Instrumentation {
+    public:
+        inline explicit Instrumentation(bool pPrintSummary = false, std::string pTracePath = "", std::ostream& pSummaryStream = std::cerr): printSummary(pPrintSummary), tracePath(std::move(pTracePath)), summaryStream(pSummaryStream), origin(std::chrono::steady_clock::now()) {
+        }
+
+        Instrumentation(const Instrumentation& other) = delete;
+
+        Instrumentation& operator=(const Instrumentation& other) = delete;
+
+        inline ~Instrumentation() {
+            if (printSummary) {
+                summaryStream << summary();
+            }
+            if (!tracePath.empty()) {
+                writeTrace(tracePath);
+            }
+        }
+
+        [[nodiscard]] bool enabled() const {
+            return printSummary || !tracePath.empty();
+        }
+
+        // Times one phase from construction to destruction. `detail` names what the phase worked
+        // on, e.g. the file in a batch build.
+        class Scope {
+            public:
+                inline Scope(Instrumentation& pOwner, const char* pName, std::string_view pDetail = {}): owner(pOwner), name(pName), detail(pDetail) {
+                    if (owner.enabled()) {
+                        start = owner.now();
+                    }
+                }
+
+                Scope(const Scope& other) = delete;
+
+                Scope& operator=(const Scope& other) = delete;
+
+                inline ~Scope() {
+                    if (owner.enabled()) {
+                        owner.record(name, detail, start, owner.now());
+                    }
+                }
+
+            private:
+                Instrumentation& owner;
+                const char* name;
+                std::string_view detail;
+                uint64_t start = 0;
+        };
+
+        // Runs `body` as the phase `name` and returns what it returns.
+        template<typename Body> decltype(auto) time(const char* name, std::string_view detail, Body&& body) {
+            Scope scope(*this, name, detail);
+            return body();
+        }
+
+        template<typename Body> decltype(auto) time(const char* name, Body&& body) {
+            return time(name, {}, std::forward<Body>(body));
+        }
+
+        // Adds `value` to the counter `name`.
+        void count(const char* name, uint64_t value) {
+            if (!enabled()) {
+                return;
+            }
+            uint64_t timestamp = now();
+            std::lock_guard<std::mutex> lock(mutex);
+            Counter* counter = nullptr;
+            for (Counter& existing: counters) {
+                if (std::string_view(existing.name) == name) {
+                    counter = &existing;
+                }
+            }
+            if (counter == nullptr) {
+                counter = &counters.emplace_back(Counter {.name = name, .total = 0});
+            }
+            counter->total += value;
+            samples.push_back({.name = name, .timestamp = timestamp, .value = counter->total, .thread = threadIndex()});
+        }
+
+        [[nodiscard]] std::string summary() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            struct Row {
+                const char* name;
+                uint64_t micros;
+                size_t calls;
+            };
+            std::vector<Row> rows;
+            uint64_t total = 0;
+            for (const Event& event: events) {
+                Row* row = nullptr;
+                for (Row& existing: rows) {
+                    if (std::string_view(existing.name) == event.name) {
+                        row = &existing;
+                    }
+                }
+                if (row == nullptr) {
+                    row = &rows.emplace_back(Row {.name = event.name, .micros = 0, .calls = 0});
+                }
+                row->micros += event.duration;
+                row->calls++;
+                total += event.duration;
+            }
+
+            std::string text = "===------------------------ Helium pass timing -------------------------===\n";
+            char line[160];
+            std::snprintf(line, sizeof(line), "  %12s  %7s  %7s  %s\n", "Time (ms)", "Share", "Calls", "Phase");
+            text.append(line);
+            for (const Row& row: rows) {
+                double share = total == 0 ? 0 : 100.0 * static_cast<double>(row.micros) / static_cast<double>(total);
+                std::snprintf(line, sizeof(line), "  %12.3f  %6.1f%%  %7zu  %s\n", static_cast<double>(row.micros) / 1000, share, row.calls, row.name);
+                text.append(line);
+            }
+            std::snprintf(line, sizeof(line), "  %12.3f  %6.1f%%  %7s  %s\n", static_cast<double>(total) / 1000, 100.0, "", "Total");
+            text.append(line);
+            if (!counters.empty()) {
+                text.append("===------------------------------ Counters ------------------------------===\n");
+                for (const Counter& counter: counters) {
+                    std::snprintf(line, sizeof(line), "  %14llu  %s\n", static_cast<unsigned long long>(counter.total), counter.name);
+                    text.append(line);
+                }
+            }
+            struct rusage usage {};
+            getrusage(RUSAGE_SELF, &usage);
+            std::snprintf(line, sizeof(line), "  Peak RSS: %.1f MiB\n", static_cast<double>(usage.ru_maxrss) / 1024);
+            text.append(line);
+            return text;
+        }
+
+        // Writes every phase as a complete ("X") event and every counter update as a counter ("C")
+        // event, in the JSON object format chrome://tracing and Perfetto load.
+        void writeTrace(const std::string& path) const {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::FILE* file = std::fopen(path.c_str(), "w");
+            if (file == nullptr) {
+                summaryStream << "Unable to write " << path << std::endl;
+                return;
+            }
+            std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+            bool first = true;
+            for (const Event& event: events) {
+                std::fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"helium\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu",
+                             first ? "" : ",\n", event.name, event.thread,
+                             static_cast<unsigned long long>(event.start), static_cast<unsigned long long>(event.duration));
+                if (!event.detail.empty()) {
+                    std::fprintf(file, ",\"args\":{\"detail\":\"%s\"}", escape(event.detail).c_str());
+                }
+                std::fputs("}", file);
+                first = false;
+            }
+            for (const Sample& sample: samples) {
+                std::fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"helium\",\"ph\":\"C\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"args\":{\"value\":%llu}}",
+                             first ? "" : ",\n", sample.name, sample.thread,
+                             static_cast<unsigned long long>(sample.timestamp), static_cast<unsigned long long>(sample.value));
+                first = false;
+            }
+            std::fputs("\n]}\n", file);
+            std::fclose(file);
+        }
+
+    private:
+        struct Event {
+            const char* name;
+            std::string detail;
+            uint64_t start;
+            uint64_t duration;
+            uint32_t thread;
+        };
+
+        struct Counter {
+            const char* name;
+            uint64_t total;
+        };
+
+        struct Sample {
+            const char* name;
+            uint64_t timestamp;
+            uint64_t value;
+            uint32_t thread;
+        };
+
+        // Microseconds since the instrumentation was created.
+        [[nodiscard]] uint64_t now() const {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+        }
+
+        void record(const char* name, std::string_view detail, uint64_t start, uint64_t end) {
+            uint32_t thread = threadIndex();
+            std::lock_guard<std::mutex> lock(mutex);
+            events.push_back({.name = name, .detail = std::string(detail), .start = start, .duration = end - start, .thread = thread});
+        }
+
+        // Small stable number per thread for the trace's tid field.
+        static uint32_t threadIndex() {
+            static std::atomic<uint32_t> nextIndex = 0;
+            thread_local uint32_t index = nextIndex.fetch_add(1);
+            return index;
+        }
+
+        static std::string escape(std::string_view text) {
+            std::string escaped;
+            for (char c: text) {
+                if (c == '"' || c == '\\') {
+                    escaped.push_back('\\');
+                    escaped.push_back(c);
+                } else if (static_cast<unsigned char>(c) < 0x20) {
+                    char code[8];
+                    std::snprintf(code, sizeof(code), "\\u%04x", c);
+                    escaped.append(code);
+                } else {
+                    escaped.push_back(c);
+                }
+            }
+            return escaped;
+        }
+
+        bool printSummary;
+        std::string tracePath;
+        std::ostream& summaryStream;
+        std::chrono::steady_clock::time_point origin;
+        mutable std::mutex mutex;
+        std::vector<Event> events;
+        std::vector<Counter> counters;
+        std::vector<Sample> samples;
+};
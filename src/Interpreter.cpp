@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Bytecode.cpp"
+
+// Runs a BytecodeProgram on any host. With GCC and Clang the code is direct threaded: each
+// instruction carries the address of its handler and every handler jumps straight to the next
+// one through a computed goto. Other compilers fall back to a switch loop.
+class Interpreter {
+    public:
+        inline explicit Interpreter(const BytecodeProgram& pProgram): program(pProgram) {
+#if defined(__GNUC__)
+            const void* const* handlers = nullptr;
+            execute(nullptr, nullptr, nullptr, &handlers);
+            threaded.reserve(program.code.size());
+            for (const BcInst& inst: program.code) {
+                threaded.push_back({
+                    .handler = handlers[static_cast<uint8_t>(inst.op)],
+                    .dst = inst.dst, .lhs = inst.lhs, .rhs = inst.rhs
+                });
+            }
+#endif
+        }
+
+        // Runs the program and returns the value passed to the first exit it reaches.
+        [[nodiscard]] uint64_t run() const {
+            std::vector<uint64_t> registers(program.registerCount);
+#if defined(__GNUC__)
+            return execute(threaded.data(), registers.data(), program.constants.data(), nullptr);
+#else
+            return execute(program.code.data(), registers.data(), program.constants.data());
+#endif
+        }
+
+    private:
+#if defined(__GNUC__)
+        struct ThreadedInst {
+            const void* handler;
+            uint32_t dst;
+            uint32_t lhs;
+            uint32_t rhs;
+        };
+
+        // Label addresses only exist inside this function, so a call without code hands out the
+        // handler table instead of running anything.
+        static uint64_t execute(const ThreadedInst* ip, uint64_t* regs, const uint64_t* constants, const void* const** handlers) {
+            // Indexed by BcOp.
+            static const void* const table[] = {&&constant, &&move, &&add, &&mul, &&exit};
+            if (handlers != nullptr) {
+                *handlers = table;
+                return 0;
+            }
+            goto *ip->handler;
+        constant:
+            regs[ip->dst] = constants[ip->lhs];
+            ++ip;
+            goto *ip->handler;
+        move:
+            regs[ip->dst] = regs[ip->lhs];
+            ++ip;
+            goto *ip->handler;
+        add:
+            regs[ip->dst] = regs[ip->lhs] + regs[ip->rhs];
+            ++ip;
+            goto *ip->handler;
+        mul:
+            regs[ip->dst] = regs[ip->lhs] * regs[ip->rhs];
+            ++ip;
+            goto *ip->handler;
+        exit:
+            return regs[ip->lhs];
+        }
+
+        std::vector<ThreadedInst> threaded;
+#else
+        static uint64_t execute(const BcInst* ip, uint64_t* regs, const uint64_t* constants) {
+            for (;; ++ip) {
+                switch (ip->op) {
+                    case BcOp::constant:
+                        regs[ip->dst] = constants[ip->lhs];
+                        break;
+                    case BcOp::move:
+                        regs[ip->dst] = regs[ip->lhs];
+                        break;
+                    case BcOp::add:
+                        regs[ip->dst] = regs[ip->lhs] + regs[ip->rhs];
+                        break;
+                    case BcOp::mul:
+                        regs[ip->dst] = regs[ip->lhs] * regs[ip->rhs];
+                        break;
+                    case BcOp::exit:
+                        return regs[ip->lhs];
+                }
+            }
+        }
+#endif
+
+        const BytecodeProgram& program;
+};
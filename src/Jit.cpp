@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "Diagnostics.cpp"
+#include "Tokenization.cpp"
+#include "Parser.cpp"
+#include "Encoding.cpp"
+#include "Pipeline.cpp"
+
+// Machine code for one program in its own mapping. The pages are filled while read+write and only
+// then switched to read+execute, so they are never writable and executable at the same time.
+class JitFunction {
+    public:
+        inline explicit JitFunction(const std::vector<uint8_t>& code) {
+            auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            size = (code.size() + pageSize - 1) / pageSize * pageSize;
+            void* pages = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (pages == MAP_FAILED) {
+                throw CompileError("Unable to map JIT code");
+            }
+            std::memcpy(pages, code.data(), code.size());
+            if (mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(pages, size);
+                throw CompileError("Unable to make JIT code executable");
+            }
+            entry = pages;
+        }
+
+        // Runs the program and returns the value passed to the first exit it reaches.
+        [[nodiscard]] inline uint64_t run() const {
+            return reinterpret_cast<uint64_t (*)()>(entry)();
+        }
+
+        inline JitFunction(JitFunction&& other) noexcept: entry(other.entry), size(other.size) {
+            other.entry = nullptr;
+            other.size = 0;
+        }
+
+        JitFunction(const JitFunction& other) = delete;
+
+        JitFunction& operator=(const JitFunction& other) = delete;
+
+        JitFunction& operator=(JitFunction&& other) = delete;
+
+        inline ~JitFunction() {
+            if (entry != nullptr) {
+                munmap(entry, size);
+            }
+        }
+
+    private:
+        void* entry = nullptr;
+        size_t size = 0;
+};
+
+// Compiles Helium source to machine code that runs inside the calling process. Errors are thrown as
+// CompileError, so one JitCompiler can compile and run any number of programs.
+class JitCompiler {
+    public:
+        inline explicit JitCompiler(int pOptimizationLevel = 1, PeepholeOptions pPeephole = {}): optimizationLevel(pOptimizationLevel), peephole(pPeephole) {
+        }
+
+        [[nodiscard]] JitFunction compile(std::string_view source) const {
+#if !defined(__x86_64__)
+            throw CompileError("The JIT requires an x86-64 host");
+#endif
+            Tokenizer tokenizer(source);
+            Parser parser(tokenizer.tokenize(), source);
+            std::optional<NodeProgram> root = parser.parseProgram();
+            if (!root.has_value()) {
+                throw CompileError("No exit node found!");
+            }
+            return compile(std::move(root.value()));
+        }
+
+        // Compiles an already parsed program, such as one loaded from a binary AST file.
+        [[nodiscard]] JitFunction compile(NodeProgram root) const {
+#if !defined(__x86_64__)
+            throw CompileError("The JIT requires an x86-64 host");
+#endif
+            MachineProgram program = CompilePipeline(optimizationLevel, peephole).compile(root, std::nullopt);
+            X86Encoder encoder;
+            return JitFunction(encoder.encodeProgram(program));
+        }
+
+        // Compiles and runs `source`, returning the value passed to its first exit.
+        [[nodiscard]] uint64_t run(std::string_view source) const {
+            return compile(source).run();
+        }
+
+    private:
+        int optimizationLevel;
+        PeepholeOptions peephole;
+};
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "Diagnostics.cpp"
+#include "Files.cpp"
+#include "RegisterAllocation.cpp"
+
+// In-memory x86-64 instructions produced by the Generator. Passes can inspect and rewrite them
+// before they are rendered as NASM text or encoded.
+enum class MOp : uint8_t {
+    mov,
+    add,
+    sub,
+    imul,
+    // Computes the address of its memory operand without accessing memory.
+    lea,
+    shl,
+    push,
+    pop,
+    ret,
+    syscall
+};
+
+enum class OperandKind : uint8_t {
+    none,
+    reg,
+    imm,
+    // QWORD [base + index * scale + disp], without the index when scale is 0
+    mem
+};
+
+struct MOperand {
+    OperandKind kind;
+    Reg reg;
+    int32_t disp;
+    uint64_t imm;
+    Reg index = Reg::rax;
+    uint8_t scale = 0;
+
+    static MOperand none() {
+        return {.kind = OperandKind::none, .reg = Reg::rax, .disp = 0, .imm = 0};
+    }
+
+    static MOperand ofReg(Reg reg) {
+        return {.kind = OperandKind::reg, .reg = reg, .disp = 0, .imm = 0};
+    }
+
+    static MOperand ofImm(uint64_t imm) {
+        return {.kind = OperandKind::imm, .reg = Reg::rax, .disp = 0, .imm = imm};
+    }
+
+    static MOperand ofMem(Reg base, int32_t disp) {
+        return {.kind = OperandKind::mem, .reg = base, .disp = disp, .imm = 0};
+    }
+
+    // `scale` is 1, 2, 4 or 8, and `index` cannot be rsp.
+    static MOperand ofMem(Reg base, Reg index, uint8_t scale, int32_t disp) {
+        return {.kind = OperandKind::mem, .reg = base, .disp = disp, .imm = 0, .index = index, .scale = scale};
+    }
+
+    [[nodiscard]] bool isReg(Reg other) const {
+        return kind == OperandKind::reg && reg == other;
+    }
+
+    // Whether the operand's value or address depends on `other`.
+    [[nodiscard]] bool reads(Reg other) const {
+        return (kind == OperandKind::reg && reg == other) || (kind == OperandKind::mem && (reg == other || (scale != 0 && index == other)));
+    }
+
+    bool operator==(const MOperand& other) const = default;
+};
+
+// One instruction. x86 has at most one immediate and one memory operand per instruction, so the
+// record keeps a kind and register per operand and shares the displacement, index and immediate.
+struct MInst {
+    MOp op;
+    uint8_t operandCount;
+    OperandKind kinds[3];
+    Reg regs[3];
+    int32_t disp;
+    Reg index;
+    uint8_t scale;
+    uint64_t imm;
+
+    static MInst make(MOp op, std::initializer_list<MOperand> operands) {
+        MInst inst {.op = op, .operandCount = 0, .kinds = {}, .regs = {}, .disp = 0, .index = Reg::rax, .scale = 0, .imm = 0};
+        for (const MOperand& operand: operands) {
+            inst.kinds[inst.operandCount] = operand.kind;
+            inst.regs[inst.operandCount] = operand.reg;
+            if (operand.kind == OperandKind::mem) {
+                inst.disp = operand.disp;
+                inst.index = operand.index;
+                inst.scale = operand.scale;
+            } else if (operand.kind == OperandKind::imm) {
+                inst.imm = operand.imm;
+            }
+            inst.operandCount++;
+        }
+        return inst;
+    }
+
+    [[nodiscard]] MOperand operand(int index) const {
+        switch (kinds[index]) {
+            case OperandKind::reg:
+                return MOperand::ofReg(regs[index]);
+            case OperandKind::imm:
+                return MOperand::ofImm(imm);
+            case OperandKind::mem:
+                return scale == 0 ? MOperand::ofMem(regs[index], disp) : MOperand::ofMem(regs[index], this->index, scale, disp);
+            default:
+                return MOperand::none();
+        }
+    }
+};
+
+static_assert(sizeof(MInst) == 24);
+
+struct MachineProgram {
+    std::string entryName;
+    std::vector<MInst> insts;
+};
+
+// Renders a MachineProgram as NASM source into one buffer sized up front.
+class AsmWriter {
+    public:
+        inline explicit AsmWriter(const MachineProgram& pProgram): program(pProgram) {
+        }
+
+        [[nodiscard]] std::string renderProgram() {
+            // Longest line is "    imul r15, QWORD [rsp + 2147483647], 18446744073709551615\n".
+            text.reserve(2 * program.entryName.size() + 16 + program.insts.size() * 64);
+            text.append("global ").append(program.entryName).append("\n");
+            text.append(program.entryName).append(":\n");
+            for (const MInst& inst: program.insts) {
+                renderInst(inst);
+            }
+            return std::move(text);
+        }
+
+        // Appends the program's instructions to `into`, without the entry label, for writing a
+        // program in pieces.
+        void renderInsts(std::string& into) {
+            std::swap(text, into);
+            for (const MInst& inst: program.insts) {
+                renderInst(inst);
+            }
+            std::swap(text, into);
+        }
+
+        // Renders the program and writes it to `path` with a single write call.
+        void writeProgram(const std::string& path) {
+            std::string rendered = renderProgram();
+            writeFile(path, rendered.data(), rendered.size(), 0644);
+        }
+
+        static const char* mnemonic(MOp op) {
+            switch (op) {
+                case MOp::mov:
+                    return "mov";
+                case MOp::add:
+                    return "add";
+                case MOp::sub:
+                    return "sub";
+                case MOp::imul:
+                    return "imul";
+                case MOp::lea:
+                    return "lea";
+                case MOp::shl:
+                    return "shl";
+                case MOp::push:
+                    return "push";
+                case MOp::pop:
+                    return "pop";
+                case MOp::ret:
+                    return "ret";
+                case MOp::syscall:
+                    return "syscall";
+            }
+            return "?";
+        }
+
+    private:
+        void renderInst(const MInst& inst) {
+            text.append("    ").append(mnemonic(inst.op));
+            for (int i = 0; i < inst.operandCount; ++i) {
+                text.append(i == 0 ? " " : ", ");
+                switch (inst.kinds[i]) {
+                    case OperandKind::reg:
+                        text.append(regName(inst.regs[i]));
+                        break;
+                    case OperandKind::imm:
+                        appendNumber(inst.imm);
+                        break;
+                    case OperandKind::mem:
+                        // lea takes no size; it only computes the address.
+                        text.append(inst.op == MOp::lea ? "[" : "QWORD [").append(regName(inst.regs[i]));
+                        if (inst.scale != 0) {
+                            text.append(" + ").append(regName(inst.index)).append("*").push_back(static_cast<char>('0' + inst.scale));
+                        }
+                        if (inst.scale == 0 || inst.disp != 0) {
+                            text.append(inst.disp < 0 ? " - " : " + ");
+                            appendNumber(inst.disp < 0 ? -static_cast<int64_t>(inst.disp) : inst.disp);
+                        }
+                        text.append("]");
+                        break;
+                    case OperandKind::none:
+                        break;
+                }
+            }
+            text.push_back('\n');
+        }
+
+        void appendNumber(uint64_t value) {
+            char digits[20];
+            auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+            text.append(digits, end);
+        }
+
+        const MachineProgram& program;
+        std::string text;
+};
@@ -1,13 +1,30 @@
-
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <optional>
 #include <vector>
+#include "Source.cpp"
 #include "Tokenization.cpp"
 #include "Parser.cpp"
+#include "ConstantFolding.cpp"
+#include "IR.cpp"
+#include "IROptimization.cpp"
 #include "Generation.cpp"
+#include "Encoding.cpp"
+#include "Elf.cpp"
+#include "Jit.cpp"
+#include "Interpreter.cpp"
+#include "Build.cpp"
+#include "Cache.cpp"
+#include "Instrumentation.cpp"
+#include "Peephole.cpp"
+#include "Pipeline.cpp"
+#include "Server.cpp"
+#include "Streaming.cpp"
+#include "Diagnostics.cpp"
 #include "AstPrinter.cpp"
+#include "AstSerialization.cpp"
+#include "Embedded.cpp"
 
 #define String std::string
 #define StringStream std::stringstream
@@ -17,46 +34,577 @@
 #define out std::ios::out
 #define FileStream std::fstream
 
-int main(int argc, char* argv[]) {
-    if (argc < 2) {
-        error << "Requires Helium File (.he Extension) As Argument" << std::endl;
+// The cache is off unless --cache-dir or HELIUM_CACHE_DIR names a directory.
+static String cacheDirFromEnvironment() {
+    const char* directory = std::getenv("HELIUM_CACHE_DIR");
+    return directory == nullptr ? "" : directory;
+}
+
+static bool parseCacheOption(const String& arg, String& cacheDir, uint64_t& cacheLimit) {
+    if (arg.starts_with("--cache-dir=")) {
+        cacheDir = arg.substr(12);
+        return true;
+    }
+    if (arg.starts_with("--cache-limit=")) {
+        cacheLimit = std::strtoull(arg.c_str() + 14, nullptr, 10) * 1024 * 1024;
+        return true;
+    }
+    return false;
+}
+
+// --peephole and --no-peephole override the -O level, --peephole-window=N sets how far rules look
+// back and --disable-peephole=RULE turns one rule off. Clears `valid` for an unknown rule.
+static bool parsePeepholeOption(const String& arg, PeepholeOptions& options, bool& valid, std::ostream& diagnostics) {
+    if (arg == "--peephole" || arg == "--no-peephole") {
+        options.enabled = arg == "--peephole";
+        return true;
+    }
+    if (arg.starts_with("--peephole-window=")) {
+        options.window = std::strtoul(arg.c_str() + 18, nullptr, 10);
+        return true;
+    }
+    if (arg.starts_with("--disable-peephole=")) {
+        int rule = PeepholeOptimizer::ruleIndex(arg.substr(19));
+        if (rule < 0) {
+            diagnostics << "Unknown peephole rule " << arg.substr(19) << std::endl;
+            valid = false;
+        } else {
+            options.disabledRules |= 1u << rule;
+        }
+        return true;
+    }
+    return false;
+}
+
+// helium cache stats|clear [--cache-dir=DIR]
+static int cacheCommand(int argc, char* argv[]) {
+    String cacheDir = cacheDirFromEnvironment();
+    uint64_t cacheLimit = CompileCache::defaultLimit;
+    String action;
+    for (int i = 2; i < argc; ++i) {
+        String arg = argv[i];
+        if (!parseCacheOption(arg, cacheDir, cacheLimit)) {
+            action = arg;
+        }
+    }
+    if (cacheDir.empty()) {
+        error << "Requires --cache-dir=DIR or HELIUM_CACHE_DIR" << std::endl;
         return EXIT_FAILURE;
     }
-    if (argc < 3) {
-        error << "Requires OS As Argument [Linux, BSD, or MacOS]" << std::endl;
+    try {
+        CompileCache cache(cacheDir, cacheLimit);
+        if (action == "clear") {
+            cache.clear();
+        } else if (action == "stats") {
+            CompileCache::Stats stats = cache.stats();
+            uint64_t lookups = stats.hits + stats.misses;
+            std::cout << "entries " << stats.entries << "\n"
+                      << "bytes " << stats.bytes << "\n"
+                      << "hits " << stats.hits << "\n"
+                      << "misses " << stats.misses << "\n"
+                      << "hit rate " << (lookups == 0 ? 0 : stats.hits * 100 / lookups) << "%" << std::endl;
+        } else {
+            error << "Unknown cache action " << action << " [stats or clear]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } catch (const CompileError& compileError) {
+        error << compileError.what() << std::endl;
         return EXIT_FAILURE;
     }
+    return EXIT_SUCCESS;
+}
 
-    String contents;
-    StringStream contents_stream;
-    {
-        FileStream input(argv[1], in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
+// helium build [-O0|-O1] [--emit=asm|exe] [--os=OS] [--jobs=N] [--out-dir=DIR] [--cache-dir=DIR]
+//              [--time-passes] [--trace=FILE] [--verbose] [peephole options] file.he|dir|@manifest...
+// Used by the command line with its own workers and streams, and by the compile server with its
+// warm workers and the client's streams.
+static int build(const Vector<String>& args, std::ostream& output, std::ostream& diagnostics, BuildWorkers* workers = nullptr) {
+    BuildOptions options;
+    bool timePasses = false;
+    bool valid = true;
+    String tracePath;
+    options.cacheDir = cacheDirFromEnvironment();
+    options.cacheLimit = CompileCache::defaultLimit;
+    Vector<String> inputs;
+#if defined(__APPLE__)
+    options.os = "MacOS";
+#elif defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+    options.os = "BSD";
+#else
+    options.os = "Linux";
+#endif
+    for (const String& arg: args) {
+        if (arg == "--time-passes") {
+            timePasses = true;
+        } else if (arg.starts_with("--trace=")) {
+            tracePath = arg.substr(8);
+        } else if (arg.starts_with("--emit=")) {
+            options.emit = arg.substr(7);
+            if (options.emit != "asm" && options.emit != "exe") {
+                diagnostics << "Unknown --emit kind " << options.emit << " for build [asm or exe]" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg.starts_with("--os=")) {
+            options.os = arg.substr(5);
+            if (options.os != "Linux" && options.os != "BSD" && options.os != "MacOS") {
+                diagnostics << "Unknown OS " << options.os << " [Linux, BSD, or MacOS]" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg.starts_with("--jobs=")) {
+            options.jobs = std::strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.starts_with("--out-dir=")) {
+            options.outDir = arg.substr(10);
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (parseCacheOption(arg, options.cacheDir, options.cacheLimit)) {
+            continue;
+        } else if (parsePeepholeOption(arg, options.peephole, valid, diagnostics)) {
+            if (!valid) {
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "-O0") {
+            options.optimizationLevel = 0;
+        } else if (arg == "-O1") {
+            options.optimizationLevel = 1;
+        } else if (arg.starts_with("-")) {
+            diagnostics << "Unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (options.emit.empty()) {
+        options.emit = options.os == "MacOS" ? "asm" : "exe";
+    }
+    if (options.emit == "exe" && options.os == "MacOS") {
+        diagnostics << "--emit=exe only supports Linux and BSD; use --emit=asm for MacOS" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (inputs.empty()) {
+        diagnostics << "Requires Helium Files (.he Extension), Directories or @Manifests As Arguments" << std::endl;
+        return EXIT_FAILURE;
     }
 
-    Tokenizer tokenizer(std::move(contents));
-    Vector<Token> tokens = tokenizer.tokenize();
+    Instrumentation instrumentation(timePasses, tracePath, diagnostics);
+    try {
+        if (!options.outDir.empty()) {
+            std::filesystem::create_directories(options.outDir);
+        }
+        std::optional<BatchBuilder> builder;
+        if (workers != nullptr) {
+            builder.emplace(options, instrumentation, *workers);
+        } else {
+            builder.emplace(options, instrumentation);
+        }
+        return builder->build(BatchBuilder::expandInputs(inputs), output, diagnostics) ? EXIT_SUCCESS : EXIT_FAILURE;
+    } catch (const std::exception& exception) {
+        diagnostics << exception.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
+
+// helium --server [--socket=PATH] [--jobs=N]
+// Serves `helium build` requests from one warm process until stopped.
+static int serverCommand(int argc, char* argv[]) {
+    String socketPath = defaultServerSocket();
+    size_t jobs = 0;
+    for (int i = 2; i < argc; ++i) {
+        String arg = argv[i];
+        if (arg.starts_with("--socket=")) {
+            socketPath = arg.substr(9);
+        } else if (arg.starts_with("--jobs=")) {
+            jobs = std::strtoul(arg.c_str() + 7, nullptr, 10);
+        } else {
+            error << "Unknown server option " << arg << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    try {
+        BuildWorkers workers(jobs);
+        CompileServer server(socketPath, [&workers](const Vector<String>& args, std::ostream& output, std::ostream& diagnostics) {
+            return build(args, output, diagnostics, &workers);
+        });
+        error << "helium server listening on " << socketPath << " with " << workers.pool.size() << (workers.pool.size() == 1 ? " thread" : " threads") << std::endl;
+        size_t served = server.serve();
+        error << "helium server stopped after " << served << (served == 1 ? " request" : " requests") << std::endl;
+    } catch (const CompileError& compileError) {
+        error << compileError.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// helium --client [--socket=PATH] --stop
+// helium --client [--socket=PATH] <helium build arguments>
+// Has the server build in this working directory and exits with the build's status.
+static int clientCommand(int argc, char* argv[]) {
+    String socketPath = defaultServerSocket();
+    bool stop = false;
+    Vector<String> args;
+    for (int i = 2; i < argc; ++i) {
+        String arg = argv[i];
+        if (arg.starts_with("--socket=")) {
+            socketPath = arg.substr(9);
+        } else if (arg == "--stop") {
+            stop = true;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    try {
+        CompileClient client(socketPath);
+        if (stop) {
+            client.stop();
+            return EXIT_SUCCESS;
+        }
+        CompileClient::Response response = client.build(args);
+        std::cout << response.output << std::flush;
+        error << response.diagnostics << std::flush;
+        return response.status;
+    } catch (const CompileError& compileError) {
+        error << compileError.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+}
 
-    Parser parser(std::move(tokens));
-    std::optional<NodeProgram> root = parser.parseProgram();
+// Assembles and links out.asm into out, storing the results in the cache when there is one. Fails
+// naming the tool when nasm or ld does.
+static int assembleAndLink(const String& os, Instrumentation& instrumentation, std::optional<CompileCache>& cache, const String& cacheKey) {
+    String nasm = os == "MacOS" ? "nasm -f macho64 out.asm" : "nasm -f elf64 out.asm";
+    String ld = os == "MacOS" ? "ld out.o -o out -macosx_version_min 10.13 -L/Library/Developer/CommandLineTools/SDKs/MacOSX13.3.sdk/usr/lib -lSystem" : "ld out.o -o out";
+    String failed;
+    if (instrumentation.time("nasm", [&] { return system(nasm.c_str()); }) != 0) {
+        failed = "nasm failed on out.asm";
+    } else if (instrumentation.time("ld", [&] { return system(ld.c_str()); }) != 0) {
+        failed = "ld failed on out.o";
+    }
+    bool linked = failed.empty();
+    if (cache.has_value()) {
+        if (linked) {
+            Instrumentation::Scope scope(instrumentation, "cache store");
+            cache->storeFile(cacheKey, "o", "out.o");
+            cache->storeFile(cacheKey, "exe", "out");
+        }
+        cache->flushStats();
+    }
+    if (!linked) {
+        error << failed << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+// Compiles `path`, or standard input for "-", with the StreamingCompiler into out or out.asm.
+static void streamSource(const String& path, const String& os, const String& emit, int optimizationLevel, const PeepholeOptions& peephole, bool verbose, Instrumentation& instrumentation) {
+    int input = path == "-" ? STDIN_FILENO : ::open(path.c_str(), O_RDONLY);
+    if (input < 0) {
+        throw CompileError("Unable to open " + path);
+    }
+    StreamingCompiler compiler(os, emit, optimizationLevel, peephole);
+    try {
+        instrumentation.time("stream compile", [&] {
+            compiler.compile(input, emit == "exe" ? "out" : "out.asm", os == "BSD" ? ElfWriter::osAbiFreeBsd : ElfWriter::osAbiSysV);
+        });
+    } catch (...) {
+        close(input);
+        throw;
+    }
+    close(input);
+    instrumentation.count("statements", compiler.statementCount());
+    instrumentation.count("variables", compiler.variableCount());
+    instrumentation.count("output bytes", compiler.outputBytes());
+    instrumentation.count("peephole rewrites", compiler.peepholeStatistics().total());
+    if (verbose) {
+        error << compiler.peepholeStatistics().report();
+    }
+}
 
-    if (!root.has_value()) {
-        std::cerr << "No exit node found!" << std::endl;
-        exit(EXIT_FAILURE);
+int main(int argc, char* argv[]) {
+    if (argc > 1 && String(argv[1]) == "build") {
+        return build(Vector<String>(argv + 2, argv + argc), std::cout, std::cerr);
+    }
+    if (argc > 1 && String(argv[1]) == "--server") {
+        return serverCommand(argc, argv);
+    }
+    if (argc > 1 && String(argv[1]) == "--client") {
+        return clientCommand(argc, argv);
+    }
+    if (argc > 1 && String(argv[1]) == "cache") {
+        return cacheCommand(argc, argv);
     }
-    ASTPrinter printer(root.value());
-    std::cout << printer.generateProgram();
 
-    Generator generator(root.value(), argv[2]);
+    Vector<String> positional;
+    int optimizationLevel = 1;
+    String emit;
+    bool jit = false;
+    bool interpret = false;
+    bool fromAst = false;
+    bool stream = false;
+    size_t jobs = 1;
+    bool timePasses = false;
+    bool verbose = false;
+    bool valid = true;
+    PeepholeOptions peephole;
+    String tracePath;
+    String cacheDir = cacheDirFromEnvironment();
+    uint64_t cacheLimit = CompileCache::defaultLimit;
+    for (int i = 1; i < argc; ++i) {
+        String arg = argv[i];
+        if (arg == "--time-passes") {
+            timePasses = true;
+        } else if (arg.starts_with("--trace=")) {
+            tracePath = arg.substr(8);
+        } else if (arg.starts_with("--emit=")) {
+            emit = arg.substr(7);
+            if (emit != "ast" && emit != "ast-bin" && emit != "ir" && emit != "asm" && emit != "exe") {
+                error << "Unknown --emit kind " << emit << " [ast, ast-bin, ir, asm, or exe]" << std::endl;
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "--jit") {
+            jit = true;
+        } else if (arg == "--interpret") {
+            interpret = true;
+        } else if (arg == "--from-ast") {
+            fromAst = true;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg.starts_with("--jobs=")) {
+            jobs = std::strtoul(arg.c_str() + 7, nullptr, 10);
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else if (parseCacheOption(arg, cacheDir, cacheLimit)) {
+            continue;
+        } else if (parsePeepholeOption(arg, peephole, valid, std::cerr)) {
+            if (!valid) {
+                return EXIT_FAILURE;
+            }
+        } else if (arg == "-O0") {
+            optimizationLevel = 0;
+        } else if (arg == "-O1") {
+            optimizationLevel = 1;
+        } else if (arg.starts_with("-") && arg != "-") {
+            error << "Unknown option " << arg << std::endl;
+            return EXIT_FAILURE;
+        } else {
+            positional.push_back(arg);
+        }
+    }
 
-    {
-        FileStream file("out.asm", out);
-        file << generator.generateProgram();
+    if (positional.empty()) {
+        error << "Requires Helium File (.he Extension) As Argument" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if ((jit || interpret) && !emit.empty()) {
+        error << (jit ? "--jit" : "--interpret") << " cannot be combined with --emit" << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (jit && interpret) {
+        error << "--jit cannot be combined with --interpret" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // The JIT and the interpreter run the program in this process, so the target OS is optional.
+    if (positional.size() < 2 && !jit && !interpret) {
+        error << "Requires OS As Argument [Linux, BSD, or MacOS]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const String os = positional.size() < 2 ? "" : positional[1];
+    if (!os.empty() && os != "Linux" && os != "BSD" && os != "MacOS") {
+        error << "Unknown OS " << os << " [Linux, BSD, or MacOS]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // The built-in writer only produces ELF, so Mach-O still goes through nasm and ld.
+    if (emit.empty()) {
+        emit = os == "MacOS" ? "asm" : "exe";
+    }
+    if (emit == "exe" && os == "MacOS") {
+        error << "--emit=exe only supports Linux and BSD; use --emit=asm for MacOS" << std::endl;
+        return EXIT_FAILURE;
+    }
+    // Streaming compiles source text straight to code, so it skips the AST, IR, cache and runners.
+    if (stream && (jit || interpret || fromAst)) {
+        error << "--stream cannot be combined with " << (jit ? "--jit" : interpret ? "--interpret" : "--from-ast") << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (stream && emit != "asm" && emit != "exe") {
+        error << "--stream only supports --emit=asm or exe" << std::endl;
+        return EXIT_FAILURE;
     }
 
-    system("nasm -f macho64 out.asm");
-    system("ld out.o -o out -macosx_version_min 10.13 -L/Library/Developer/CommandLineTools/SDKs/MacOSX13.3.sdk/usr/lib -lSystem");
+    // Prints the timing table and writes the trace on every return path below.
+    Instrumentation instrumentation(timePasses, tracePath);
+    std::optional<CompileCache> cache;
+    String cacheKey;
+    try {
+        if (stream) {
+            streamSource(positional[0], os, emit, optimizationLevel, peephole, verbose, instrumentation);
+            return emit == "exe" ? EXIT_SUCCESS : assembleAndLink(os, instrumentation, cache, cacheKey);
+        }
 
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
+        SourceBuffer source = instrumentation.time("read source", [&] {
+            return SourceBuffer::open(positional[0]);
+        });
+        instrumentation.count("source bytes", source.view().size());
+
+        // Exits with the same status the compiled executable would.
+        if (jit) {
+            JitCompiler compiler(optimizationLevel, peephole);
+            JitFunction function = instrumentation.time("jit compile", [&] {
+                return fromAst ? compiler.compile(AstReader::readProgram(source.view())) : compiler.compile(source.view());
+            });
+            uint64_t result = instrumentation.time("run", [&] {
+                return function.run();
+            });
+            return static_cast<int>(result & 0xFF);
+        }
+
+        bool cachedAsm = false;
+        if (!cacheDir.empty() && !interpret && (emit == "exe" || emit == "asm")) {
+            Instrumentation::Scope scope(instrumentation, "cache lookup");
+            cache.emplace(cacheDir, cacheLimit);
+            cacheKey = CompileCache::keyFor(source.view(), os, "-O" + std::to_string(optimizationLevel) + " --emit=" + emit + " " + peephole.flags() + (fromAst ? " --from-ast" : ""));
+            if (emit == "exe" && cache->fetch(cacheKey, "exe", "out")) {
+                cache->flushStats();
+                return EXIT_SUCCESS;
+            }
+            // An asm hit also brings back the object and executable nasm and ld made from it.
+            if (emit == "asm" && cache->fetch(cacheKey, "asm", "out.asm")) {
+                if (cache->restore(cacheKey, "o", "out.o") && cache->restore(cacheKey, "exe", "out")) {
+                    cache->flushStats();
+                    return EXIT_SUCCESS;
+                }
+                cachedAsm = true;
+            }
+        }
+
+        if (!cachedAsm) {
+            // --jobs=N lexes large sources and generates code for large programs on N threads, and
+            // --jobs=0 on one per core.
+            std::optional<ThreadPool> pool;
+            if (jobs != 1) {
+                pool.emplace(jobs == 0 ? std::thread::hardware_concurrency() : jobs);
+            }
+            std::optional<NodeProgram> root;
+            if (fromAst) {
+                // The program's arrays point into the mapped file, which outlives it.
+                root = instrumentation.time("load AST", [&] {
+                    return AstReader::readProgram(source.view());
+                });
+            } else {
+                Vector<Token> tokens = instrumentation.time("tokenize", [&] {
+                    Tokenizer tokenizer(source.view());
+                    return pool.has_value() ? tokenizer.tokenize(pool.value()) : tokenizer.tokenize();
+                });
+                instrumentation.count("tokens", tokens.size());
+
+                Parser parser(std::move(tokens), source.view());
+                root = instrumentation.time("parse", [&] {
+                    return parser.parseProgram();
+                });
+            }
+
+            if (!root.has_value()) {
+                throw CompileError("No exit node found!");
+            }
+            instrumentation.count("AST nodes", root->nodeCount());
+            if (emit == "ast") {
+                ASTPrinter printer(root.value());
+                std::string text = instrumentation.time("print AST", [&] {
+                    return printer.generateProgram();
+                });
+                std::cout << text;
+                return EXIT_SUCCESS;
+            }
+            if (emit == "ast-bin") {
+                Instrumentation::Scope scope(instrumentation, "write AST");
+                AstWriter(root.value()).writeProgram("out.ast");
+                return EXIT_SUCCESS;
+            }
+
+            CompilePipeline pipeline(optimizationLevel, peephole);
+            if (pipeline.foldsConstants()) {
+                Instrumentation::Scope scope(instrumentation, "fold constants");
+                CompilePipeline::foldConstants(root.value());
+            }
+
+            if (interpret) {
+                BytecodeProgram bytecode = instrumentation.time("compile bytecode", [&] {
+                    BytecodeCompiler compiler(root.value());
+                    return compiler.compileProgram();
+                });
+                instrumentation.count("bytecode instructions", bytecode.code.size());
+                Interpreter interpreter(bytecode);
+                uint64_t result = instrumentation.time("run", [&] {
+                    return interpreter.run();
+                });
+                return static_cast<int>(result & 0xFF);
+            }
+
+            IRModule module;
+            instrumentation.time("lower IR", [&] {
+                CompilePipeline::lower(module, root.value());
+            });
+            if (pipeline.optimizesIR()) {
+                Instrumentation::Scope scope(instrumentation, "optimize IR");
+                CompilePipeline::optimizeIR(module);
+            }
+            instrumentation.count("IR values", module.valueCount());
+
+            if (emit == "ir") {
+                IRPrinter printer(module);
+                std::string text = instrumentation.time("print IR", [&] {
+                    return printer.printModule();
+                });
+                std::cout << text;
+                return EXIT_SUCCESS;
+            }
+
+            MachineProgram program = instrumentation.time("generate", [&] {
+                Generator generator(module, os);
+                return pool.has_value() ? generator.generateProgram(pool.value()) : generator.generateProgram();
+            });
+            instrumentation.count("arena bytes", module.arenaStats().peakBytesUsed);
+            if (pipeline.runsPeephole()) {
+                PeepholeOptimizer::Stats rewrites = instrumentation.time("peephole", [&] {
+                    return pipeline.optimizeMachineCode(program);
+                });
+                instrumentation.count("peephole rewrites", rewrites.total());
+                if (verbose) {
+                    error << rewrites.report();
+                }
+            }
+            instrumentation.count("instructions", program.insts.size());
+
+            if (emit == "exe") {
+                std::vector<uint8_t> code = instrumentation.time("encode", [&] {
+                    X86Encoder encoder;
+                    return encoder.encodeProgram(program);
+                });
+                instrumentation.count("code bytes", code.size());
+                instrumentation.time("write executable", [&] {
+                    ElfWriter writer(code, os == "BSD" ? ElfWriter::osAbiFreeBsd : ElfWriter::osAbiSysV);
+                    writer.writeExecutable("out");
+                });
+                if (cache.has_value()) {
+                    Instrumentation::Scope scope(instrumentation, "cache store");
+                    cache->storeFile(cacheKey, "exe", "out");
+                    cache->flushStats();
+                }
+                return EXIT_SUCCESS;
+            }
+
+            instrumentation.time("write asm", [&] {
+                AsmWriter writer(program);
+                writer.writeProgram("out.asm");
+            });
+            if (cache.has_value()) {
+                Instrumentation::Scope scope(instrumentation, "cache store");
+                cache->storeFile(cacheKey, "asm", "out.asm");
+            }
+        }
+    } catch (const CompileError& compileError) {
+        error << compileError.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    return assembleAndLink(os, instrumentation, cache, cacheKey);
+}
@@ -1,90 +1,229 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string_view>
 #include <vector>
 #include "./Tokenization.cpp"
-#include "variant"
-#include "Arena.cpp"
+#include "Diagnostics.cpp"
 
-struct NodeTermIntLit {
-    Token int_lit;
+enum class NodeKind : uint8_t {
+    // Literal value split over lhs (low half) and rhs (high half), wrapped to 64 bits.
+    int_lit,
+    ident,
+    // lhs + rhs
+    add,
+    // lhs * rhs
+    mul,
+    // exit(lhs)
+    stmt_exit,
+    // var <token> = lhs
+    stmt_var
 };
 
-struct NodeTermIdent {
-    Token ident;
-};
+using NodeIndex = uint32_t;
 
-struct NodeExpr;
+// Array of trivially copyable elements that owns its storage or, for a program loaded from a binary
+// AST, points into the mapped file. The first change to a mapped array copies it into owned storage,
+// so passes that only read never copy.
+template<typename T> class NodeArray {
+    public:
+        NodeArray() = default;
 
-struct NodeBinExprAdd {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
+        inline NodeArray(std::vector<T> elements): storage(std::move(elements)), begin_(storage.data()), size_(storage.size()), capacity(storage.size()) {
+        }
 
-struct NodeBinExprMulti {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
+        // Views `size` elements at `data`, which must outlive the array.
+        static NodeArray mapped(const T* data, size_t size) {
+            NodeArray array;
+            array.begin_ = const_cast<T*>(data);
+            array.size_ = size;
+            return array;
+        }
 
-struct NodeBinExpr {
-    std::variant<NodeBinExprAdd*, NodeBinExprMulti*> var;
-};
+        inline NodeArray(const NodeArray& other): NodeArray(std::vector<T>(other.begin(), other.end())) {
+        }
 
-struct NodeTerm {
-    std::variant<NodeTermIdent*, NodeTermIntLit*> var;
-};
+        inline NodeArray(NodeArray&& other) noexcept: storage(std::move(other.storage)), begin_(other.begin_), size_(other.size_), capacity(other.capacity) {
+            other.begin_ = nullptr;
+            other.size_ = 0;
+            other.capacity = 0;
+        }
 
-struct NodeExpr {
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-};
+        NodeArray& operator=(NodeArray other) noexcept {
+            std::swap(storage, other.storage);
+            std::swap(begin_, other.begin_);
+            std::swap(size_, other.size_);
+            std::swap(capacity, other.capacity);
+            return *this;
+        }
 
+        [[nodiscard]] const T& operator[](size_t index) const {
+            return begin_[index];
+        }
 
-struct NodeStmtExit {
-    NodeExpr* expr;
-};
+        T& operator[](size_t index) {
+            if (isMapped()) [[unlikely]] {
+                reallocate(size_);
+            }
+            return begin_[index];
+        }
 
-struct NodeStmtVar {
-    Token ident;
-    NodeExpr* expr;
-};
+        [[nodiscard]] const T* begin() const {
+            return begin_;
+        }
+
+        [[nodiscard]] const T* end() const {
+            return begin_ + size_;
+        }
+
+        [[nodiscard]] size_t size() const {
+            return size_;
+        }
+
+        [[nodiscard]] bool empty() const {
+            return size_ == 0;
+        }
+
+        void push_back(const T& element) {
+            // A mapped array has no capacity, so this also detaches it.
+            if (size_ == capacity) [[unlikely]] {
+                reallocate(std::max<size_t>(16, size_ * 2));
+            }
+            begin_[size_++] = element;
+        }
+
+        void reserve(size_t minimum) {
+            if (minimum > capacity) {
+                reallocate(minimum);
+            }
+        }
 
-struct NodeStmt {
-    std::variant<NodeStmtExit*, NodeStmtVar*> var;
+    private:
+        [[nodiscard]] bool isMapped() const {
+            return begin_ != storage.data();
+        }
+
+        // Moves the elements into owned storage with room for `newCapacity`. The storage is kept at
+        // full capacity, and size_ says how much of it is in use.
+        void reallocate(size_t newCapacity) {
+            if (isMapped()) {
+                std::vector<T> owned(newCapacity);
+                std::copy(begin_, begin_ + size_, owned.begin());
+                storage = std::move(owned);
+            } else {
+                storage.resize(newCapacity);
+            }
+            begin_ = storage.data();
+            capacity = newCapacity;
+        }
+
+        std::vector<T> storage;
+        T* begin_ = nullptr;
+        size_t size_ = 0;
+        size_t capacity = 0;
 };
 
-struct NodeProgram {
-    std::vector<NodeStmt*> stmts;
+// Flat AST. Nodes live in parallel arrays indexed by NodeIndex and refer to their children and
+// tokens by 32 bit index, so a node costs 13 bytes and passes walk it with a switch on its kind.
+// The compiler stores them in NodeArrays; embedded programs (Embedded.cpp) use fixed-capacity
+// arrays instead so that they can be built in constant evaluation.
+template<template<typename> class Array> struct BasicNodeProgram {
+    static constexpr uint32_t noToken = UINT32_MAX;
+
+    Array<NodeKind> kinds;
+    Array<uint32_t> tokenIndices;
+    Array<NodeIndex> lhs;
+    Array<NodeIndex> rhs;
+    Array<NodeIndex> stmts;
+    Array<Token> tokens;
+    // Text the program's tokens point into; it must outlive the program.
+    std::string_view source;
+    // One more than the largest symbol ID the program's identifiers use.
+    uint32_t symbolCount = 0;
+
+    constexpr NodeIndex addNode(NodeKind kind, uint32_t token, NodeIndex lhsIndex, NodeIndex rhsIndex) {
+        auto index = static_cast<NodeIndex>(kinds.size());
+        kinds.push_back(kind);
+        tokenIndices.push_back(token);
+        lhs.push_back(lhsIndex);
+        rhs.push_back(rhsIndex);
+        return index;
+    }
+
+    constexpr NodeIndex addLiteral(uint64_t value, uint32_t token = noToken) {
+        return addNode(NodeKind::int_lit, token, static_cast<uint32_t>(value), static_cast<uint32_t>(value >> 32));
+    }
+
+    // Turns `node` into a literal in place, keeping its token.
+    constexpr void setLiteral(NodeIndex node, uint64_t value) {
+        kinds[node] = NodeKind::int_lit;
+        lhs[node] = static_cast<uint32_t>(value);
+        rhs[node] = static_cast<uint32_t>(value >> 32);
+    }
+
+    [[nodiscard]] constexpr uint64_t literalValue(NodeIndex node) const {
+        return static_cast<uint64_t>(rhs[node]) << 32 | lhs[node];
+    }
+
+    // Source text of the node's token; empty for nodes made by passes.
+    [[nodiscard]] constexpr std::string_view text(NodeIndex node) const {
+        uint32_t token = tokenIndices[node];
+        return token == noToken ? std::string_view() : tokens[token].text(source);
+    }
+
+    // Interned symbol of an ident or stmt_var node.
+    [[nodiscard]] constexpr SymbolId symbol(NodeIndex node) const {
+        return tokens[tokenIndices[node]].symbol;
+    }
+
+    [[nodiscard]] constexpr size_t nodeCount() const {
+        return kinds.size();
+    }
+
+    [[nodiscard]] static constexpr bool isBinary(NodeKind kind) {
+        return kind == NodeKind::add || kind == NodeKind::mul;
+    }
 };
 
-class Parser {
+using NodeProgram = BasicNodeProgram<NodeArray>;
+
+// Precedence climbing parser. Everything here is constexpr, so embedded programs are parsed by the
+// same code in constant evaluation.
+template<typename Program> class BasicParser {
     public:
-        inline explicit Parser(std::vector<Token> pTokens): tokens(std::move(pTokens)), allocator(1024 * 1024 * 50) {
-        }
-
-        std::optional<NodeTerm*> parseTerm() {
-            if (auto intLit = tryConsume(TokenType::int_lit)) {
-                auto intLitTerm = allocator.alloc<NodeTermIntLit>();
-                intLitTerm->int_lit = intLit.value();
-                auto term = allocator.alloc<NodeTerm>();
-                term->var = intLitTerm;
-                return term;
-            } else if (auto ident = tryConsume(TokenType::ident)) {
-                auto identTerm = allocator.alloc<NodeTermIdent>();
-                identTerm->ident = ident.value();
-                auto expr = allocator.alloc<NodeTerm>();
-                expr->var = identTerm;
-                return expr;
+        using Tokens = decltype(Program::tokens);
+
+        // Every node consumes at least one token, so the node arrays are sized from the token count.
+        constexpr explicit BasicParser(Tokens pTokens, std::string_view pSource) {
+            program.source = pSource;
+            program.tokens = std::move(pTokens);
+            size_t capacity = program.tokens.size();
+            program.kinds.reserve(capacity);
+            program.tokenIndices.reserve(capacity);
+            program.lhs.reserve(capacity);
+            program.rhs.reserve(capacity);
+        }
+
+        constexpr std::optional<NodeIndex> parseTerm() {
+            if (tryConsume(TokenType::int_lit).has_value()) {
+                uint32_t token = index - 1;
+                return program.addLiteral(literalValue(program.tokens[token]), token);
+            } else if (tryConsume(TokenType::ident).has_value()) {
+                noteSymbol(index - 1);
+                return program.addNode(NodeKind::ident, index - 1, 0, 0);
             } else {
                 return {};
             }
         }
 
-        std::optional<NodeExpr*> parseExpr(int minPrec = 0) {
-            std::optional<NodeTerm*> lhsTerm = parseTerm();
+        constexpr std::optional<NodeIndex> parseExpr(int minPrec = 0) {
+            std::optional<NodeIndex> lhsTerm = parseTerm();
             if (!lhsTerm.has_value()) {
                 return {};
             }
-            auto lhsExpr = allocator.alloc<NodeExpr>();
-            lhsExpr->var = lhsTerm.value();
+            NodeIndex lhsExpr = lhsTerm.value();
 
             while (true) {
                 std::optional<Token> currentToken = peek();
@@ -97,143 +236,109 @@ class Parser {
                 } else {
                     break;
                 }
+                uint32_t opToken = index;
                 Token op = consume();
                 int nextMinimumPrecedence = precedence.value();
                 auto rhsExpr = parseExpr(nextMinimumPrecedence);
 
                 if (!rhsExpr.has_value()) {
-                    std::cerr << "Unable to parse expression" << std::endl;
-                    exit(EXIT_FAILURE);
-                }
-                auto expr = allocator.alloc<NodeBinExpr>();
-                auto lhsExpr2 = allocator.alloc<NodeExpr>();
-                if (op.type == TokenType::plus) {
-                    auto add = allocator.alloc<NodeBinExprAdd>();
-                    lhsExpr2->var = lhsExpr->var;
-                    add->lhs = lhsExpr2;
-                    add->rhs = rhsExpr.value();
-                    expr->var = add;
-                } else if (op.type == TokenType::star) {
-                    auto multi = allocator.alloc<NodeBinExprMulti>();
-                    lhsExpr2->var = lhsExpr->var;
-                    multi->lhs = lhsExpr2;
-                    multi->rhs = rhsExpr.value();
-
-                    expr->var = multi;
+                    throw CompileError("Unable to parse expression");
                 }
-                lhsExpr->var = expr;
+                NodeKind kind = op.type == TokenType::plus ? NodeKind::add : NodeKind::mul;
+                lhsExpr = program.addNode(kind, opToken, lhsExpr, rhsExpr.value());
             }
             return lhsExpr;
+        }
 
-//            if (auto term = parseTerm()) {
-//                if (tryConsume(TokenType::plus).has_value()) {
-//                        auto binExpr = allocator.alloc<NodeBinExpr>();
-//                        auto binExprAdd = allocator.alloc<NodeBinExprAdd>();
-//                        auto lhsExpr = allocator.alloc<NodeExpr>();
-//                        lhsExpr->var = term.value();
-//                        binExprAdd->lhs = lhsExpr;
-//                        if (auto rhs = parseExpr()) {
-//                            binExprAdd->rhs = rhs.value();
-//                            binExpr->var = binExprAdd;
-//                            auto expr = allocator.alloc<NodeExpr>();
-//                            expr->var = binExpr;
-//                            return expr;
-//                        } else {
-//                            std::cerr << "Expected Expression" << std::endl;
-//                            exit(EXIT_FAILURE);
-//                        }
-//                } else {
-//                    auto expr = allocator.alloc<NodeExpr>();
-//                    expr->var = term.value();
-//                    return expr;
-//                }
-//            } else {
-//                return {};
-//            }
-        }
-
-        std::optional<NodeStmt*> parseStmt() {
+        constexpr std::optional<NodeIndex> parseStmt() {
             if (peek().value().type == TokenType::exit && peek(1).has_value() && peek(1).value().type == TokenType::open_paren) {
+                uint32_t exitToken = index;
                 consume();
                 consume();
-                NodeStmtExit* stmtExit;
+                NodeIndex stmtExit;
                 if (auto exprNode = parseExpr()) {
-                    stmtExit = allocator.alloc<NodeStmtExit>();
-                    stmtExit->expr = exprNode.value();
+                    stmtExit = program.addNode(NodeKind::stmt_exit, exitToken, exprNode.value(), 0);
                 } else {
-                    std::cerr << "Exit Does Not Contain An Integer/Expression as exit code!" << std::endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError("Exit Does Not Contain An Integer/Expression as exit code!");
                 }
                 tryConsume(TokenType::close_paren, ')');
                 tryConsume(TokenType::semi, ';');
-                auto stmtNode = allocator.alloc<NodeStmt>();
-                stmtNode->var = stmtExit;
-                return stmtNode;
+                return stmtExit;
             } else if (peek().has_value() && peek().value().type == TokenType::var && peek(1).has_value() && peek(1).value().type == TokenType::ident && peek(2).has_value() && peek(2).value().type == TokenType::eq) {
                 consume();
-                auto varStmt = allocator.alloc<NodeStmtVar>();
-                varStmt->ident = consume();
+                uint32_t identToken = index;
+                noteSymbol(identToken);
+                consume();
                 consume();
+                NodeIndex varStmt;
                 if (auto expr = parseExpr()) {
-                    varStmt->expr = expr.value();
+                    varStmt = program.addNode(NodeKind::stmt_var, identToken, expr.value(), 0);
                 } else {
-                    std::cerr << "Invalid expression for identifier!" << std::endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError("Invalid expression for identifier!");
                 }
                 tryConsume(TokenType::semi, ';');
-                auto stmtNode = allocator.alloc<NodeStmt>();
-                stmtNode->var = varStmt;
-                return stmtNode;
+                return varStmt;
             } else {
                 return {};
             }
         }
 
-        std::optional<NodeProgram> parseProgram() {
-            NodeProgram program;
+        // Hands over the program, which owns the tokens from here on; the parser is spent afterwards.
+        constexpr std::optional<Program> parseProgram() {
             while (peek().has_value()) {
                 if (auto stmt = parseStmt()) {
                     program.stmts.push_back(stmt.value());
                 } else {
-                    std::cerr << "Invalid Statement" << std::endl;
-                    exit(EXIT_FAILURE);
+                    throw CompileError("Invalid Statement");
                 }
             }
-            return program;
+            return std::move(program);
         }
 
     private:
-        const std::vector<Token> tokens;
-        size_t index = 0;
-        ArenaAllocator allocator;
+        Program program;
+        uint32_t index = 0;
 
 
-        [[nodiscard]] inline std::optional<Token> peek(int offset = 0) const {
-            if (index + offset >= tokens.size()) {
+        [[nodiscard]] constexpr std::optional<Token> peek(int offset = 0) const {
+            if (index + offset >= program.tokens.size()) {
                 return {};
             } else {
-                return tokens.at(index + offset);
+                return program.tokens[index + offset];
             }
         }
 
-        inline Token consume() {
-            return tokens.at(index++);
+        [[nodiscard]] constexpr uint64_t literalValue(const Token& token) const {
+            uint64_t value = 0;
+            for (char c: token.text(program.source)) {
+                value = value * 10 + (c - '0');
+            }
+            return value;
+        }
+
+        constexpr void noteSymbol(uint32_t token) {
+            program.symbolCount = std::max(program.symbolCount, program.tokens[token].symbol + 1);
         }
 
-        inline Token tryConsume(TokenType type, char c) {
+        constexpr Token consume() {
+            return program.tokens[index++];
+        }
+
+        constexpr Token tryConsume(TokenType type, char c) {
             if (peek().has_value() && peek().value().type == type) {
                 return consume();
             } else {
-                std::cerr << "Expected '" << c << "'" << std::endl;
-                exit(EXIT_FAILURE);
+                throw CompileError(std::string("Expected '") + c + "'");
             }
         }
 
-        inline std::optional<Token> tryConsume(TokenType type) {
+        constexpr std::optional<Token> tryConsume(TokenType type) {
             if (peek().has_value() && peek().value().type == type) {
                 return consume();
             } else {
                 return {};
             }
         }
-};
\ No newline at end of file
+};
+
+using Parser = BasicParser<NodeProgram>;
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "MachineCode.cpp"
+
+// Rewrites short instruction sequences in a MachineProgram. Instructions are appended to the output
+// one at a time, and after each one every rule gets to rewrite the tail of the output until none
+// applies, so a rewrite that exposes another pattern is picked up right away. Rules look at most
+// `window` instructions back. Nothing here reads flags, so rewrites may change them freely.
+struct PeepholeOptions {
+    size_t window = 8;
+    // Bit i disables rule i of PeepholeOptimizer::rules.
+    uint32_t disabledRules = 0;
+    // Unset to run the pass at -O1 only.
+    std::optional<bool> enabled {};
+
+    [[nodiscard]] bool runsAt(int optimizationLevel) const {
+        return enabled.value_or(optimizationLevel >= 1);
+    }
+
+    // For cache keys, since the options change the generated code.
+    [[nodiscard]] std::string flags() const {
+        std::string text = "--peephole-window=" + std::to_string(window) + " --disabled-peephole-rules=" + std::to_string(disabledRules);
+        if (enabled.has_value()) {
+            text.append(enabled.value() ? " --peephole" : " --no-peephole");
+        }
+        return text;
+    }
+};
+
+class PeepholeOptimizer {
+    public:
+        struct Rule {
+            const char* name;
+            bool (*apply)(std::vector<MInst>& insts, size_t window);
+        };
+
+        static constexpr size_t ruleCount = 9;
+
+        static const std::array<Rule, ruleCount> rules;
+
+        struct Stats {
+            std::array<uint64_t, ruleCount> hits {};
+
+            void merge(const Stats& other) {
+                for (size_t i = 0; i < hits.size(); ++i) {
+                    hits[i] += other.hits[i];
+                }
+            }
+
+            [[nodiscard]] uint64_t total() const {
+                uint64_t sum = 0;
+                for (uint64_t count: hits) {
+                    sum += count;
+                }
+                return sum;
+            }
+
+            // One line per rule, for verbose output.
+            [[nodiscard]] std::string report() const {
+                std::string text = "Peephole rewrites:\n";
+                char line[96];
+                for (size_t i = 0; i < hits.size(); ++i) {
+                    std::snprintf(line, sizeof(line), "  %10llu  %s\n", static_cast<unsigned long long>(hits[i]), rules[i].name);
+                    text.append(line);
+                }
+                std::snprintf(line, sizeof(line), "  %10llu  total\n", static_cast<unsigned long long>(total()));
+                text.append(line);
+                return text;
+            }
+        };
+
+        inline explicit PeepholeOptimizer(PeepholeOptions pOptions = {}): options(pOptions) {
+        }
+
+        void optimizeProgram(MachineProgram& program) {
+            std::vector<MInst> output;
+            output.reserve(program.insts.size());
+            for (const MInst& inst: program.insts) {
+                output.push_back(inst);
+                bool changed = true;
+                while (changed && !output.empty()) {
+                    changed = false;
+                    for (size_t i = 0; i < rules.size() && !changed; ++i) {
+                        if ((options.disabledRules >> i & 1) == 0 && rules[i].apply(output, options.window)) {
+                            stats.hits[i]++;
+                            changed = true;
+                        }
+                    }
+                }
+            }
+            program.insts = std::move(output);
+        }
+
+        [[nodiscard]] const Stats& statistics() const {
+            return stats;
+        }
+
+        // Index of the rule called `name`, or -1.
+        [[nodiscard]] static int ruleIndex(std::string_view name) {
+            for (size_t i = 0; i < rules.size(); ++i) {
+                if (name == rules[i].name) {
+                    return static_cast<int>(i);
+                }
+            }
+            return -1;
+        }
+
+    private:
+        [[nodiscard]] static bool isMove(const MInst& inst) {
+            return inst.op == MOp::mov && inst.operandCount == 2;
+        }
+
+        [[nodiscard]] static bool readsReg(const MOperand& operand, Reg reg) {
+            return operand.reads(reg);
+        }
+
+        // Whether the instruction stores to its first operand.
+        [[nodiscard]] static bool writesFirst(const MInst& inst) {
+            switch (inst.op) {
+                case MOp::mov:
+                case MOp::add:
+                case MOp::sub:
+                case MOp::imul:
+                case MOp::lea:
+                case MOp::shl:
+                case MOp::pop:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        // mov x, x
+        static bool selfMove(std::vector<MInst>& insts, size_t) {
+            const MInst& last = insts.back();
+            if (!isMove(last) || last.operand(0) != last.operand(1)) {
+                return false;
+            }
+            insts.pop_back();
+            return true;
+        }
+
+        // add x, 0 / sub x, 0 / imul r, r, 1
+        static bool identityArithmetic(std::vector<MInst>& insts, size_t) {
+            const MInst& last = insts.back();
+            bool addsZero = (last.op == MOp::add || last.op == MOp::sub) && last.kinds[1] == OperandKind::imm && last.imm == 0;
+            bool timesOne = last.op == MOp::imul && last.operandCount == 3 && last.operand(0) == last.operand(1) && last.imm == 1;
+            if (!addsZero && !timesOne) {
+                return false;
+            }
+            insts.pop_back();
+            return true;
+        }
+
+        // imul r, x, 0 => mov r, 0
+        static bool multiplyByZero(std::vector<MInst>& insts, size_t) {
+            MInst& last = insts.back();
+            if (last.op != MOp::imul || last.operandCount != 3 || last.imm != 0) {
+                return false;
+            }
+            last = MInst::make(MOp::mov, {last.operand(0), MOperand::ofImm(0)});
+            return true;
+        }
+
+        // mov r, a; add r, b => mov r, a + b, and likewise for sub, shl and imul r, r, b.
+        static bool foldImmediates(std::vector<MInst>& insts, size_t) {
+            if (insts.size() < 2) {
+                return false;
+            }
+            const MInst& first = insts[insts.size() - 2];
+            const MInst& second = insts.back();
+            if (!isMove(first) || first.kinds[0] != OperandKind::reg || first.kinds[1] != OperandKind::imm || first.regs[0] == Reg::rsp) {
+                return false;
+            }
+            MOperand reg = first.operand(0);
+            uint64_t value;
+            if ((second.op == MOp::add || second.op == MOp::sub) && second.operand(0) == reg && second.kinds[1] == OperandKind::imm) {
+                value = second.op == MOp::add ? first.imm + second.imm : first.imm - second.imm;
+            } else if (second.op == MOp::shl && second.operand(0) == reg) {
+                value = first.imm << second.imm;
+            } else if (second.op == MOp::imul && second.operandCount == 3 && second.operand(0) == reg && second.operand(1) == reg) {
+                value = first.imm * second.imm;
+            } else {
+                return false;
+            }
+            insts.pop_back();
+            insts.back() = MInst::make(MOp::mov, {reg, MOperand::ofImm(value)});
+            return true;
+        }
+
+        // mov [m], r; mov s, [m] => mov [m], r; mov s, r
+        static bool forwardStore(std::vector<MInst>& insts, size_t) {
+            if (insts.size() < 2) {
+                return false;
+            }
+            const MInst& store = insts[insts.size() - 2];
+            MInst& load = insts.back();
+            if (!isMove(store) || !isMove(load) || store.kinds[0] != OperandKind::mem || store.kinds[1] != OperandKind::reg
+                || load.kinds[0] != OperandKind::reg || load.operand(1) != store.operand(0)) {
+                return false;
+            }
+            load = MInst::make(MOp::mov, {load.operand(0), store.operand(1)});
+            return true;
+        }
+
+        // mov r, x; mov x, r => mov r, x
+        static bool storeBack(std::vector<MInst>& insts, size_t) {
+            if (insts.size() < 2) {
+                return false;
+            }
+            const MInst& first = insts[insts.size() - 2];
+            const MInst& second = insts.back();
+            if (!isMove(first) || !isMove(second) || first.operand(0) != second.operand(1) || first.operand(1) != second.operand(0)) {
+                return false;
+            }
+            insts.pop_back();
+            return true;
+        }
+
+        // mov x, a; mov x, b => mov x, b when b does not read x.
+        static bool deadMove(std::vector<MInst>& insts, size_t) {
+            if (insts.size() < 2) {
+                return false;
+            }
+            const MInst& first = insts[insts.size() - 2];
+            const MInst& second = insts.back();
+            if (!isMove(first) || !isMove(second) || first.operand(0) != second.operand(0)) {
+                return false;
+            }
+            MOperand dest = second.operand(0);
+            MOperand source = second.operand(1);
+            if (dest.reg == Reg::rsp || (dest.kind == OperandKind::reg && readsReg(source, dest.reg)) || (dest.kind == OperandKind::mem && source == dest)) {
+                return false;
+            }
+            insts.erase(insts.end() - 2);
+            return true;
+        }
+
+        // push x; pop x => nothing, and push r; pop y => mov y, r.
+        static bool pushPop(std::vector<MInst>& insts, size_t) {
+            if (insts.size() < 2) {
+                return false;
+            }
+            const MInst& push = insts[insts.size() - 2];
+            const MInst& pop = insts.back();
+            if (push.op != MOp::push || pop.op != MOp::pop || push.kinds[0] != OperandKind::reg) {
+                return false;
+            }
+            MInst move = MInst::make(MOp::mov, {pop.operand(0), push.operand(0)});
+            insts.pop_back();
+            insts.pop_back();
+            if (move.operand(0) != move.operand(1)) {
+                insts.push_back(move);
+            }
+            return true;
+        }
+
+        // mov r, [rsp + k] when r already holds that slot: an earlier load of it into r, or store of
+        // r to it, with nothing in between that writes r, the slot or rsp.
+        static bool redundantReload(std::vector<MInst>& insts, size_t window) {
+            const MInst& load = insts.back();
+            if (!isMove(load) || load.kinds[0] != OperandKind::reg || load.kinds[1] != OperandKind::mem || load.regs[1] != Reg::rsp) {
+                return false;
+            }
+            MOperand reg = load.operand(0);
+            MOperand slot = load.operand(1);
+            size_t oldest = insts.size() - 1 > window ? insts.size() - 1 - window : 0;
+            for (size_t i = insts.size() - 1; i-- > oldest;) {
+                const MInst& inst = insts[i];
+                if (isMove(inst) && ((inst.operand(0) == reg && inst.operand(1) == slot) || (inst.operand(0) == slot && inst.operand(1) == reg))) {
+                    insts.pop_back();
+                    return true;
+                }
+                if (inst.op == MOp::push || inst.op == MOp::pop || inst.op == MOp::ret || inst.op == MOp::syscall) {
+                    return false;
+                }
+                if (writesFirst(inst)) {
+                    MOperand dest = inst.operand(0);
+                    if (dest.isReg(reg.reg) || dest.isReg(Reg::rsp)) {
+                        return false;
+                    }
+                    if (dest.kind == OperandKind::mem && (dest.reg != Reg::rsp || std::abs(static_cast<int64_t>(dest.disp) - slot.disp) < 8)) {
+                        return false;
+                    }
+                }
+            }
+            return false;
+        }
+
+        PeepholeOptions options;
+        Stats stats {};
+};
+
+inline const std::array<PeepholeOptimizer::Rule, PeepholeOptimizer::ruleCount> PeepholeOptimizer::rules = {{
+    {"self-move", selfMove},
+    {"identity-arithmetic", identityArithmetic},
+    {"multiply-by-zero", multiplyByZero},
+    {"fold-immediates", foldImmediates},
+    {"forward-store", forwardStore},
+    {"store-back", storeBack},
+    {"dead-move", deadMove},
+    {"push-pop", pushPop},
+    {"redundant-reload", redundantReload},
+}};
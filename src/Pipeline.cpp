@@ -0,0 +1,75 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include "ConstantFolding.cpp"
+#include "IR.cpp"
+#include "IROptimization.cpp"
+#include "Generation.cpp"
+#include "Parser.cpp"
+#include "Peephole.cpp"
+
+// The passes from a parsed program to machine code and the optimization level each one runs at,
+// kept in one place so the driver, `helium build`, the JIT and the benchmarks generate the same
+// code. The drivers run the stages one at a time to time each of them; compile() runs them all.
+class CompilePipeline {
+    public:
+        inline CompilePipeline(int pOptimizationLevel, PeepholeOptions pPeephole): optimizationLevel(pOptimizationLevel), peephole(pPeephole) {
+        }
+
+        [[nodiscard]] bool foldsConstants() const {
+            return optimizationLevel >= 1;
+        }
+
+        [[nodiscard]] bool optimizesIR() const {
+            return optimizationLevel >= 1;
+        }
+
+        [[nodiscard]] bool runsPeephole() const {
+            return peephole.runsAt(optimizationLevel);
+        }
+
+        static void foldConstants(NodeProgram& root) {
+            ConstantFolder folder(root);
+            folder.foldProgram();
+        }
+
+        static void lower(IRModule& module, const NodeProgram& root) {
+            IRLowering lowering(module, root);
+            lowering.lowerProgram();
+        }
+
+        static void optimizeIR(IRModule& module) {
+            IROptimizer optimizer(module);
+            optimizer.optimizeModule();
+        }
+
+        // Returns the rewrites made.
+        PeepholeOptimizer::Stats optimizeMachineCode(MachineProgram& program) const {
+            PeepholeOptimizer optimizer(peephole);
+            optimizer.optimizeProgram(program);
+            return optimizer.statistics();
+        }
+
+        // Runs every stage on `root`, which is folded in place. Generates a program entry point for
+        // `os`, or without one a function for the JIT.
+        [[nodiscard]] MachineProgram compile(NodeProgram& root, const std::optional<std::string>& os) const {
+            if (foldsConstants()) {
+                foldConstants(root);
+            }
+            IRModule module;
+            lower(module, root);
+            if (optimizesIR()) {
+                optimizeIR(module);
+            }
+            MachineProgram program = os.has_value() ? Generator(module, os.value()).generateProgram() : Generator(module).generateProgram();
+            if (runsPeephole()) {
+                optimizeMachineCode(program);
+            }
+            return program;
+        }
+
+    private:
+        int optimizationLevel;
+        PeepholeOptions peephole;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <queue>
+#include <vector>
+
+// General purpose registers, numbered the way x86-64 encodes them.
+enum class Reg : uint8_t {
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15
+};
+
+inline const char* regName(Reg reg) {
+    static constexpr const char* names[] = {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+    };
+    return names[static_cast<uint8_t>(reg)];
+}
+
+// Small set of registers as a bit mask, used for the free lists of both allocators.
+struct RegSet {
+    uint16_t bits = 0;
+
+    static constexpr RegSet of(std::initializer_list<Reg> regs) {
+        RegSet set;
+        for (Reg reg: regs) {
+            set.add(reg);
+        }
+        return set;
+    }
+
+    [[nodiscard]] constexpr bool contains(Reg reg) const {
+        return bits & (1u << static_cast<uint8_t>(reg));
+    }
+
+    [[nodiscard]] constexpr bool empty() const {
+        return bits == 0;
+    }
+
+    [[nodiscard]] int size() const {
+        return __builtin_popcount(bits);
+    }
+
+    constexpr void add(Reg reg) {
+        bits |= 1u << static_cast<uint8_t>(reg);
+    }
+
+    constexpr void remove(Reg reg) {
+        bits &= ~(1u << static_cast<uint8_t>(reg));
+    }
+
+    constexpr RegSet operator&(RegSet other) const {
+        return {.bits = static_cast<uint16_t>(bits & other.bits)};
+    }
+
+    // Lowest numbered register in the set; the set must not be empty.
+    Reg take() {
+        Reg reg = static_cast<Reg>(__builtin_ctz(bits));
+        remove(reg);
+        return reg;
+    }
+};
+
+// Where a value lives: a register, or an 8 byte slot in the fixed stack frame at [rsp + 8 * slot].
+struct Location {
+    bool spilled;
+    Reg reg;
+    uint32_t slot;
+
+    static Location inReg(Reg reg) {
+        return {.spilled = false, .reg = reg, .slot = 0};
+    }
+
+    static Location inSlot(uint32_t slot) {
+        return {.spilled = true, .reg = Reg::rax, .slot = slot};
+    }
+};
+
+// Live range of a value in terms of instruction (or statement) positions, both ends inclusive.
+struct LiveInterval {
+    size_t start;
+    size_t end;
+    Location location {};
+};
+
+// Poletto & Sarkar linear scan. Intervals are assigned registers from the pool in order of their
+// start; when the pool runs dry the interval that ends last is sent to a stack slot. Only intervals
+// holding a register stay on the active list.
+class LinearScanAllocator {
+    public:
+        inline explicit LinearScanAllocator(RegSet pPool): pool(pPool) {
+        }
+
+        // Intervals must be sorted by start. Returns how many stack slots the spilled intervals need.
+        uint32_t allocate(std::vector<LiveInterval>& intervals) {
+            RegSet freeRegs = pool;
+            // Stack slots keyed by the position at which their last occupant dies, soonest first.
+            // Spilling an active interval moves its whole range to memory, so a slot is only reused
+            // once it is free from the start of the new occupant onwards.
+            using SlotUse = std::pair<size_t, uint32_t>;
+            std::priority_queue<SlotUse, std::vector<SlotUse>, std::greater<>> slots;
+            uint32_t slotCount = 0;
+            std::vector<size_t> active;
+
+            auto spill = [&](LiveInterval& interval) {
+                uint32_t slot;
+                if (!slots.empty() && slots.top().first <= interval.start) {
+                    slot = slots.top().second;
+                    slots.pop();
+                } else {
+                    slot = slotCount++;
+                }
+                slots.push({interval.end, slot});
+                interval.location = Location::inSlot(slot);
+            };
+
+            for (size_t i = 0; i < intervals.size(); ++i) {
+                LiveInterval& current = intervals[i];
+                std::erase_if(active, [&](size_t index) {
+                    if (intervals[index].end <= current.start) {
+                        freeRegs.add(intervals[index].location.reg);
+                        return true;
+                    }
+                    return false;
+                });
+
+                if (!freeRegs.empty()) {
+                    current.location = Location::inReg(freeRegs.take());
+                    active.push_back(i);
+                    continue;
+                }
+
+                auto furthest = std::max_element(active.begin(), active.end(), [&](size_t a, size_t b) {
+                    return intervals[a].end < intervals[b].end;
+                });
+                if (furthest != active.end() && intervals[*furthest].end > current.end) {
+                    current.location = intervals[*furthest].location;
+                    spill(intervals[*furthest]);
+                    *furthest = i;
+                } else {
+                    spill(current);
+                }
+            }
+            return slotCount;
+        }
+
+    private:
+        RegSet pool;
+};
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// Character classification for the lexer. Whitespace runs, identifiers and integer literals are
+// scanned a whole vector at a time (32 bytes with AVX2, 16 with SSE2) and fall back to a table
+// lookup per byte for the tail, on hosts without either instruction set and in constant evaluation.
+namespace scan {
+
+    enum CharClass : uint8_t {
+        invalid = 0,
+        space = 1 << 0,
+        alpha = 1 << 1,
+        digit = 1 << 2,
+        punct = 1 << 3
+    };
+
+    // Same sets as isspace/isalpha/isdigit in the "C" locale, without the locale lookup.
+    constexpr std::array<uint8_t, 256> makeClassTable() {
+        std::array<uint8_t, 256> table {};
+        for (int c = 0; c < 256; ++c) {
+            if (c == ' ' || (c >= '\t' && c <= '\r')) {
+                table[c] = space;
+            } else if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+                table[c] = alpha;
+            } else if (c >= '0' && c <= '9') {
+                table[c] = digit;
+            }
+        }
+        for (char c: {'(', ')', ';', '+', '*', '='}) {
+            table[static_cast<unsigned char>(c)] = punct;
+        }
+        return table;
+    }
+
+    inline constexpr std::array<uint8_t, 256> classTable = makeClassTable();
+
+    constexpr uint8_t classOf(char c) {
+        return classTable[static_cast<unsigned char>(c)];
+    }
+
+    constexpr const char* scalarSkip(const char* p, const char* end, uint8_t classes) {
+        while (p < end && (classOf(*p) & classes)) {
+            ++p;
+        }
+        return p;
+    }
+
+#if defined(__AVX2__)
+    constexpr int blockSize = 32;
+    using Block = __m256i;
+
+    inline Block load(const char* p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+
+    inline Block splat(char c) {
+        return _mm256_set1_epi8(c);
+    }
+
+    // Bytes >= 0x80 are negative as signed chars, so they fall outside every range tested here.
+    inline Block inRange(Block v, char low, char high) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(v, splat(static_cast<char>(low - 1))), _mm256_cmpgt_epi8(splat(static_cast<char>(high + 1)), v));
+    }
+
+    inline Block either(Block a, Block b) {
+        return _mm256_or_si256(a, b);
+    }
+
+    inline Block equals(Block v, char c) {
+        return _mm256_cmpeq_epi8(v, splat(c));
+    }
+
+    inline uint32_t mismatches(Block matches) {
+        return ~static_cast<uint32_t>(_mm256_movemask_epi8(matches));
+    }
+#elif defined(__SSE2__)
+    constexpr int blockSize = 16;
+    using Block = __m128i;
+
+    inline Block load(const char* p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+
+    inline Block splat(char c) {
+        return _mm_set1_epi8(c);
+    }
+
+    inline Block inRange(Block v, char low, char high) {
+        return _mm_and_si128(_mm_cmpgt_epi8(v, splat(static_cast<char>(low - 1))), _mm_cmplt_epi8(v, splat(static_cast<char>(high + 1))));
+    }
+
+    inline Block either(Block a, Block b) {
+        return _mm_or_si128(a, b);
+    }
+
+    inline Block equals(Block v, char c) {
+        return _mm_cmpeq_epi8(v, splat(c));
+    }
+
+    inline uint32_t mismatches(Block matches) {
+        return ~static_cast<uint32_t>(_mm_movemask_epi8(matches)) & 0xFFFFu;
+    }
+#endif
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    inline Block isSpace(Block v) {
+        return either(equals(v, ' '), inRange(v, '\t', '\r'));
+    }
+
+    inline Block isDigit(Block v) {
+        return inRange(v, '0', '9');
+    }
+
+    inline Block isAlnum(Block v) {
+        return either(inRange(either(v, splat(0x20)), 'a', 'z'), isDigit(v));
+    }
+
+    // Advances over whole blocks while every byte matches, then finishes the run with the table.
+    template<Block (*Matches)(Block)>
+    inline const char* vectorSkip(const char* p, const char* end, uint8_t classes) {
+        while (end - p >= blockSize) {
+            uint32_t mask = mismatches(Matches(load(p)));
+            if (mask != 0) {
+                return p + __builtin_ctz(mask);
+            }
+            p += blockSize;
+        }
+        return scalarSkip(p, end, classes);
+    }
+#endif
+
+    constexpr const char* skipSpace(const char* p, const char* end) {
+#if defined(__AVX2__) || defined(__SSE2__)
+        if (std::is_constant_evaluated()) {
+            return scalarSkip(p, end, space);
+        }
+        return vectorSkip<isSpace>(p, end, space);
+#else
+        return scalarSkip(p, end, space);
+#endif
+    }
+
+    constexpr const char* skipDigits(const char* p, const char* end) {
+#if defined(__AVX2__) || defined(__SSE2__)
+        if (std::is_constant_evaluated()) {
+            return scalarSkip(p, end, digit);
+        }
+        return vectorSkip<isDigit>(p, end, digit);
+#else
+        return scalarSkip(p, end, digit);
+#endif
+    }
+
+    constexpr const char* skipAlnum(const char* p, const char* end) {
+#if defined(__AVX2__) || defined(__SSE2__)
+        if (std::is_constant_evaluated()) {
+            return scalarSkip(p, end, alpha | digit);
+        }
+        return vectorSkip<isAlnum>(p, end, alpha | digit);
+#else
+        return scalarSkip(p, end, alpha | digit);
+#endif
+    }
+}
@@ -0,0 +1,332 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <initializer_list>
+#include <tuple>
+#include <optional>
+#include "Encoding.cpp"
+#include "MachineCode.cpp"
+
+// Chooses the instructions for additions and multiplications by a constant. Every way of computing
+// the result that fits the operands is written out as a candidate sequence and the cheapest by
+// cost() wins: lea for non-destructive sums, scaled indices and x * 3, 5 or 9, shifts for powers of
+// two, shift and add for 2^k +- 1, and imul when nothing beats it.
+class InstructionSelector {
+    public:
+        // Latency along the sequence's dependency chain, then fused-domain uops, which is one per
+        // instruction for every form emitted here, then code size.
+        struct Cost {
+            uint32_t cycles = 0;
+            uint32_t uops = 0;
+            uint32_t bytes = 0;
+
+            auto operator<=>(const Cost& other) const = default;
+        };
+
+        // The longest candidate is accumulating a scaled index through the spare: five instructions.
+        struct Sequence {
+            std::array<MInst, 5> insts {};
+            uint8_t count = 0;
+
+            void add(MOp op, std::initializer_list<MOperand> operands) {
+                insts[count++] = MInst::make(op, operands);
+            }
+
+            [[nodiscard]] const MInst* begin() const {
+                return insts.data();
+            }
+
+            [[nodiscard]] const MInst* end() const {
+                return insts.data() + count;
+            }
+        };
+
+        // base + index * scale + disp, where base and index are register, memory or immediate
+        // operands, or none. The index is none when scale is 0.
+        struct Sum {
+            MOperand base = MOperand::none();
+            MOperand index = MOperand::none();
+            uint8_t scale = 0;
+            int32_t disp = 0;
+        };
+
+        // `spare` may be overwritten by any sequence; it must differ from every register operand.
+        inline explicit InstructionSelector(Reg pSpare): spare(pSpare) {
+        }
+
+        // Cycles per instruction are Skylake's, from Agner Fog's tables: register moves are
+        // eliminated at rename and immediate moves start no chain, a load adds 4, imul takes 3 and
+        // lea takes 3 with three components and 1 otherwise.
+        [[nodiscard]] static uint32_t latency(const MInst& inst) {
+            bool loads = inst.op != MOp::lea && inst.operandCount > 1 && inst.kinds[1] == OperandKind::mem;
+            uint32_t cycles;
+            switch (inst.op) {
+                case MOp::mov:
+                    cycles = 0;
+                    break;
+                case MOp::imul:
+                    cycles = 3;
+                    break;
+                case MOp::lea:
+                    cycles = inst.kinds[1] == OperandKind::mem && inst.scale != 0 && inst.disp != 0 ? 3 : 1;
+                    break;
+                default:
+                    cycles = 1;
+                    break;
+            }
+            return cycles + (loads ? 4 : 0);
+        }
+
+        [[nodiscard]] Cost cost(const Sequence& sequence) {
+            return {.cycles = cycles(sequence), .uops = sequence.count, .bytes = bytes(sequence)};
+        }
+
+        // target = source * factor, where factor fits a sign-extended imm32.
+        [[nodiscard]] Sequence selectMultiply(Reg target, const MOperand& source, uint64_t factor) {
+            MOperand dest = MOperand::ofReg(target);
+            best.reset();
+            bestCost = unselected;
+            if (factor == 0) {
+                Sequence zero;
+                zero.add(MOp::mov, {dest, MOperand::ofImm(0)});
+                return zero;
+            }
+
+            // The lea and shift forms work on a register, so the source is first copied to the target.
+            Sequence copied;
+            if (source != dest) {
+                copied.add(MOp::mov, {dest, source});
+            }
+            if (factor == 1) {
+                return copied;
+            }
+            Sequence product;
+            if (source.kind == OperandKind::imm) {
+                product = copied;
+                product.add(MOp::imul, {dest, dest, MOperand::ofImm(factor)});
+            } else {
+                product.add(MOp::imul, {dest, source, MOperand::ofImm(factor)});
+            }
+            unsigned shift = static_cast<unsigned>(__builtin_ctzll(factor));
+            uint64_t odd = factor >> shift;
+            if (!hasShortForm(factor, odd)) {
+                return product;
+            }
+            consider(product);
+            auto shifted = [&](Sequence candidate) {
+                if (shift == 1) {
+                    Sequence doubled = candidate;
+                    doubled.add(MOp::add, {dest, dest});
+                    consider(doubled);
+                }
+                if (shift > 0) {
+                    candidate.add(MOp::shl, {dest, MOperand::ofImm(shift)});
+                }
+                consider(candidate);
+            };
+            if (odd == 1) {
+                shifted(copied);
+            }
+            // One or two of lea t, [t + t * 2, 4 or 8] for odd parts made of 3, 5 and 9.
+            for (uint64_t first: {3, 5, 9}) {
+                if (odd == first) {
+                    Sequence candidate = scaleBy(copied, dest, source, first);
+                    shifted(candidate);
+                }
+                for (uint64_t second: {3, 5, 9}) {
+                    if (odd == first * second) {
+                        Sequence candidate = scaleBy(copied, dest, source, first);
+                        candidate.add(MOp::lea, {dest, MOperand::ofMem(target, target, static_cast<uint8_t>(second - 1), 0)});
+                        shifted(candidate);
+                    }
+                }
+            }
+            // 2^k + 1 and 2^k - 1 need the source intact after the shift.
+            if (source.kind == OperandKind::reg && source != dest) {
+                for (bool plus: {true, false}) {
+                    uint64_t power = plus ? factor - 1 : factor + 1;
+                    if (power >= 4 && (power & (power - 1)) == 0) {
+                        Sequence candidate;
+                        candidate.add(MOp::mov, {dest, source});
+                        candidate.add(MOp::shl, {dest, MOperand::ofImm(__builtin_ctzll(power))});
+                        candidate.add(plus ? MOp::add : MOp::sub, {dest, source});
+                        consider(candidate);
+                    }
+                }
+            }
+            return best.value();
+        }
+
+        // target = sum. Operands other than the target are left unchanged. Only a base or an
+        // unscaled index may be an immediate.
+        [[nodiscard]] Sequence selectSum(Reg target, Sum sum) {
+            MOperand dest = MOperand::ofReg(target);
+            MOperand disp = MOperand::ofImm(static_cast<uint64_t>(static_cast<int64_t>(sum.disp)));
+            best.reset();
+            bestCost = unselected;
+            if (sum.scale == 1 && sum.base.kind == OperandKind::none) {
+                sum.base = sum.index;
+                sum.scale = 0;
+            }
+            if (sum.base.kind == OperandKind::none && sum.scale == 0) {
+                Sequence constant;
+                constant.add(MOp::mov, {dest, disp});
+                return constant;
+            }
+            if (sum.scale == 1 && sum.index == dest && sum.base != dest) {
+                std::swap(sum.base, sum.index);
+            }
+            // Adding one operand to the target is a single uop of one cycle and no lea is shorter.
+            if (sum.base == dest && (sum.scale == 0 || (sum.scale == 1 && sum.disp == 0))) {
+                Sequence added;
+                if (sum.scale == 1 || sum.disp != 0) {
+                    added.add(MOp::add, {dest, sum.scale == 1 ? sum.index : disp});
+                }
+                return added;
+            }
+
+            // Accumulate in the target, shifting a scaled index in the spare when the target is
+            // still needed.
+            Sequence accumulated;
+            bool accumulates = true;
+            bool indexInSpare = sum.scale > 1 && sum.base.kind != OperandKind::none && (sum.base == dest || sum.index.reads(target));
+            if (indexInSpare) {
+                accumulates = target != spare;
+                accumulated.add(MOp::mov, {MOperand::ofReg(spare), sum.index});
+                accumulated.add(MOp::shl, {MOperand::ofReg(spare), MOperand::ofImm(__builtin_ctz(sum.scale))});
+                if (sum.base != dest) {
+                    accumulated.add(MOp::mov, {dest, sum.base});
+                }
+                accumulated.add(MOp::add, {dest, MOperand::ofReg(spare)});
+            } else if (sum.scale > 1) {
+                if (sum.index != dest) {
+                    accumulated.add(MOp::mov, {dest, sum.index});
+                }
+                accumulated.add(MOp::shl, {dest, MOperand::ofImm(__builtin_ctz(sum.scale))});
+                if (sum.base.kind != OperandKind::none) {
+                    accumulated.add(MOp::add, {dest, sum.base});
+                }
+            } else if (sum.scale == 0 || sum.base == dest || !sum.index.reads(target)) {
+                if (sum.base != dest) {
+                    accumulated.add(MOp::mov, {dest, sum.base});
+                }
+                if (sum.scale == 1) {
+                    accumulated.add(MOp::add, {dest, sum.index});
+                }
+            } else {
+                accumulates = false;
+            }
+            if (accumulates) {
+                if (sum.disp != 0) {
+                    accumulated.add(MOp::add, {dest, disp});
+                }
+                consider(accumulated);
+            }
+
+            // lea, after loading memory operands into the spare and, when it is free, the target.
+            Sequence loads;
+            bool spareFree = true;
+            bool targetFree = target != spare && !sum.base.reads(target) && !(sum.scale != 0 && sum.index.reads(target));
+            bool registers = true;
+            for (MOperand* leaf: {&sum.base, &sum.index}) {
+                if (leaf == &sum.index && sum.scale == 0) {
+                    break;
+                }
+                if (leaf->kind == OperandKind::mem && (spareFree || targetFree)) {
+                    Reg into = spareFree ? spare : target;
+                    (spareFree ? spareFree : targetFree) = false;
+                    loads.add(MOp::mov, {MOperand::ofReg(into), *leaf});
+                    *leaf = MOperand::ofReg(into);
+                }
+                registers = registers && leaf->kind == OperandKind::reg;
+            }
+            if (registers) {
+                Sequence candidate = loads;
+                candidate.add(MOp::lea, {dest, sum.scale == 0 ? MOperand::ofMem(sum.base.reg, sum.disp) : MOperand::ofMem(sum.base.reg, sum.index.reg, sum.scale, sum.disp)});
+                consider(candidate);
+                if (sum.scale != 0 && sum.disp != 0) {
+                    Sequence split = loads;
+                    split.add(MOp::lea, {dest, MOperand::ofMem(sum.base.reg, sum.index.reg, sum.scale, 0)});
+                    split.add(MOp::add, {dest, disp});
+                    consider(split);
+                }
+            }
+            return best.value();
+        }
+
+    private:
+        [[nodiscard]] static uint32_t cycles(const Sequence& sequence) {
+            uint32_t total = 0;
+            for (const MInst& inst: sequence) {
+                total += latency(inst);
+            }
+            return total;
+        }
+
+        [[nodiscard]] uint32_t bytes(const Sequence& sequence) {
+            uint32_t total = 0;
+            for (const MInst& inst: sequence) {
+                total += static_cast<uint32_t>(encoder.encodedSize(inst));
+            }
+            return total;
+        }
+
+        // Same order as comparing cost(), but sequences are only encoded to break a tie in cycles
+        // and uops.
+        void consider(const Sequence& candidate) {
+            uint32_t candidateCycles = cycles(candidate);
+            auto order = std::tie(candidateCycles, candidate.count) <=> std::tie(bestCost.cycles, bestCost.uops);
+            if (order > 0) {
+                return;
+            }
+            if (order == 0) {
+                if (bestCost.bytes == 0) {
+                    bestCost.bytes = bytes(best.value());
+                }
+                uint32_t candidateBytes = bytes(candidate);
+                if (candidateBytes >= bestCost.bytes) {
+                    return;
+                }
+                bestCost.bytes = candidateBytes;
+            } else {
+                bestCost.bytes = 0;
+            }
+            best = candidate;
+            bestCost.cycles = candidateCycles;
+            bestCost.uops = candidate.count;
+        }
+
+        // Whether a shift, lea or 2^k +- 1 candidate exists for the factor; imul is the only choice
+        // for every other one.
+        [[nodiscard]] static bool hasShortForm(uint64_t factor, uint64_t odd) {
+            for (uint64_t product: {1, 3, 5, 9, 15, 25, 27, 45, 81}) {
+                if (odd == product) {
+                    return true;
+                }
+            }
+            uint64_t below = factor - 1;
+            uint64_t above = factor + 1;
+            return (below & (below - 1)) == 0 || (above & (above - 1)) == 0;
+        }
+
+        // `copied` followed by lea t, [r + r * (factor - 1)], where r is the source if it is a
+        // register and the target otherwise.
+        [[nodiscard]] static Sequence scaleBy(const Sequence& copied, const MOperand& dest, const MOperand& source, uint64_t factor) {
+            Reg from = source.kind == OperandKind::reg ? source.reg : dest.reg;
+            Sequence candidate;
+            if (source.kind != OperandKind::reg) {
+                candidate = copied;
+            }
+            candidate.add(MOp::lea, {dest, MOperand::ofMem(from, from, static_cast<uint8_t>(factor - 1), 0)});
+            return candidate;
+        }
+
+        Reg spare;
+        X86Encoder encoder;
+        std::optional<Sequence> best;
+        // Worse than every candidate, so the first one considered is taken.
+        static constexpr Cost unselected {.cycles = UINT32_MAX, .uops = UINT32_MAX, .bytes = 0};
+        // bytes stays 0 until a tie needs it.
+        Cost bestCost = unselected;
+};
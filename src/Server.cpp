@@ -0,0 +1,328 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "Diagnostics.cpp"
+
+// Wire format shared by the compile server and its client: a message is a 32 bit field count
+// followed by every field as a 32 bit length and its bytes, all little endian. A request holds the
+// client's working directory followed by its `helium build` arguments, or the single field "stop".
+// A response holds the exit status in decimal, the text for stdout and the text for stderr.
+class CompileConnection {
+    public:
+        inline explicit CompileConnection(int pFd): fd(pFd) {
+        }
+
+        CompileConnection(const CompileConnection& other) = delete;
+
+        CompileConnection& operator=(const CompileConnection& other) = delete;
+
+        inline ~CompileConnection() {
+            close(fd);
+        }
+
+        void send(const std::vector<std::string>& fields) {
+            std::string buffer;
+            appendWord(buffer, fields.size());
+            for (const std::string& field: fields) {
+                appendWord(buffer, field.size());
+                buffer.append(field);
+            }
+            const char* p = buffer.data();
+            size_t remaining = buffer.size();
+            while (remaining > 0) {
+                ssize_t written = ::send(fd, p, remaining, MSG_NOSIGNAL);
+                if (written < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (written <= 0) {
+                    throw CompileError(std::string("Lost the compile server connection: ") + std::strerror(errno));
+                }
+                p += written;
+                remaining -= written;
+            }
+        }
+
+        // Empty when the other side closed the connection before sending anything. Fields grow as
+        // their bytes arrive, so a header claiming more than is sent costs no memory.
+        std::optional<std::vector<std::string>> receive() {
+            uint32_t count;
+            if (!readExactly(&count, sizeof(count), true)) {
+                return {};
+            }
+            count = fromLittleEndian(count);
+            if (count > maxFieldCount) {
+                throw CompileError("Malformed compile server message");
+            }
+            std::vector<std::string> fields;
+            uint64_t total = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                uint32_t length;
+                readExactly(&length, sizeof(length), false);
+                length = fromLittleEndian(length);
+                total += length;
+                if (total > maxMessageLength) {
+                    throw CompileError("Malformed compile server message");
+                }
+                std::string field;
+                while (field.size() < length) {
+                    size_t done = field.size();
+                    field.resize(done + std::min<size_t>(length - done, readChunk));
+                    readExactly(field.data() + done, field.size() - done, false);
+                }
+                fields.push_back(std::move(field));
+            }
+            return fields;
+        }
+
+    private:
+        static constexpr uint32_t maxFieldCount = 64 * 1024;
+        static constexpr uint64_t maxMessageLength = 256u * 1024 * 1024;
+        static constexpr size_t readChunk = 64 * 1024;
+
+        static void appendWord(std::string& buffer, size_t value) {
+            for (int i = 0; i < 4; ++i) {
+                buffer.push_back(static_cast<char>(value >> (8 * i)));
+            }
+        }
+
+        static uint32_t fromLittleEndian(uint32_t value) {
+            auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+            return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+        }
+
+        // Returns false on a clean end of stream before the first byte when `endAllowed` is set.
+        bool readExactly(void* destination, size_t size, bool endAllowed) {
+            auto* p = static_cast<char*>(destination);
+            size_t done = 0;
+            while (done < size) {
+                ssize_t got = ::recv(fd, p + done, size - done, 0);
+                if (got < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (got == 0 && done == 0 && endAllowed) {
+                    return false;
+                }
+                if (got <= 0) {
+                    throw CompileError("Lost the compile server connection");
+                }
+                done += got;
+            }
+            return true;
+        }
+
+        int fd;
+};
+
+// $HELIUM_SOCKET, or a per-user socket in $XDG_RUNTIME_DIR or /tmp.
+inline std::string defaultServerSocket() {
+    if (const char* path = std::getenv("HELIUM_SOCKET")) {
+        return path;
+    }
+    if (const char* runtime = std::getenv("XDG_RUNTIME_DIR")) {
+        return std::string(runtime) + "/helium.sock";
+    }
+    return "/tmp/helium-" + std::to_string(getuid()) + ".sock";
+}
+
+inline sockaddr_un serverAddress(const std::string& path) {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw CompileError("Socket path too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+// Long-lived compiler process behind a Unix domain socket. Requests are served one at a time, in
+// the client's working directory, by `handler`; whatever state the handler keeps (threads, arenas)
+// stays warm between them. A client that stalls for clientTimeoutSeconds is dropped so it cannot
+// hold up the others. SIGINT, SIGTERM and a "stop" request shut the server down.
+class CompileServer {
+    public:
+        using Handler = std::function<int(const std::vector<std::string>& args, std::ostream& output, std::ostream& diagnostics)>;
+
+        // The socket is bound by `pSocketPath` as given but kept as an absolute path, since serving
+        // a request changes the working directory.
+        inline CompileServer(const std::string& pSocketPath, Handler pHandler): socketPath(std::filesystem::absolute(pSocketPath).string()), handler(std::move(pHandler)) {
+            listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (listener < 0) {
+                throw CompileError(std::string("Unable to create socket: ") + std::strerror(errno));
+            }
+            sockaddr_un address = serverAddress(pSocketPath);
+            // Only the owner may connect; the socket is created with the umask in effect.
+            mode_t oldMask = umask(0077);
+            int bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+            if (bound != 0 && errno == EADDRINUSE && !serverAnswers(address)) {
+                unlink(socketPath.c_str());
+                bound = bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address));
+            }
+            umask(oldMask);
+            if (bound != 0) {
+                int failure = errno;
+                close(listener);
+                throw CompileError(failure == EADDRINUSE ? "A compile server is already listening on " + socketPath : "Unable to bind " + socketPath + ": " + std::strerror(failure));
+            }
+            if (listen(listener, 64) != 0) {
+                close(listener);
+                unlink(socketPath.c_str());
+                throw CompileError(std::string("Unable to listen: ") + std::strerror(errno));
+            }
+        }
+
+        CompileServer(const CompileServer& other) = delete;
+
+        CompileServer& operator=(const CompileServer& other) = delete;
+
+        inline ~CompileServer() {
+            close(listener);
+            unlink(socketPath.c_str());
+        }
+
+        // Serves requests until stopped. Returns the number served.
+        size_t serve() {
+            stopRequested() = 0;
+            struct sigaction action {};
+            action.sa_handler = [](int) { stopRequested() = 1; };
+            // No SA_RESTART, so a signal interrupts accept() and the loop sees the flag.
+            sigaction(SIGINT, &action, nullptr);
+            sigaction(SIGTERM, &action, nullptr);
+            size_t served = 0;
+            while (!stopRequested()) {
+                int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (client < 0) {
+                    if (errno == EINTR || errno == ECONNABORTED) {
+                        continue;
+                    }
+                    throw CompileError(std::string("accept failed: ") + std::strerror(errno));
+                }
+                timeval timeout {.tv_sec = clientTimeoutSeconds, .tv_usec = 0};
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                CompileConnection connection(client);
+                try {
+                    if (handle(connection)) {
+                        served++;
+                    }
+                } catch (const std::exception& failure) {
+                    std::cerr << "helium server: " << failure.what() << std::endl;
+                }
+            }
+            return served;
+        }
+
+    private:
+        // Longest a client may leave a request or response half sent.
+        static constexpr time_t clientTimeoutSeconds = 5;
+
+        static volatile std::sig_atomic_t& stopRequested() {
+            static volatile std::sig_atomic_t flag = 0;
+            return flag;
+        }
+
+        static bool serverAnswers(const sockaddr_un& address) {
+            int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            bool answers = probe >= 0 && connect(probe, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+            if (probe >= 0) {
+                close(probe);
+            }
+            return answers;
+        }
+
+        bool handle(CompileConnection& connection) {
+            std::optional<std::vector<std::string>> request = connection.receive();
+            if (!request.has_value() || request->empty()) {
+                return false;
+            }
+            if (request->size() == 1 && request->front() == "stop") {
+                stopRequested() = 1;
+                connection.send({"0", "", ""});
+                return false;
+            }
+            std::ostringstream output;
+            std::ostringstream diagnostics;
+            int status = EXIT_FAILURE;
+            if (chdir(request->front().c_str()) != 0) {
+                diagnostics << "Unable to enter " << request->front() << ": " << std::strerror(errno) << "\n";
+            } else {
+                std::vector<std::string> args(request->begin() + 1, request->end());
+                try {
+                    status = handler(args, output, diagnostics);
+                } catch (const std::exception& failure) {
+                    diagnostics << failure.what() << "\n";
+                }
+            }
+            connection.send({std::to_string(status), output.str(), diagnostics.str()});
+            return true;
+        }
+
+        std::string socketPath;
+        Handler handler;
+        int listener = -1;
+};
+
+// Client side: sends one request and hands back the server's answer.
+class CompileClient {
+    public:
+        struct Response {
+            int status;
+            std::string output;
+            std::string diagnostics;
+        };
+
+        inline explicit CompileClient(std::string pSocketPath): socketPath(std::move(pSocketPath)) {
+        }
+
+        // Builds `args` as `helium build` would, in this process' working directory.
+        [[nodiscard]] Response build(const std::vector<std::string>& args) const {
+            char directory[4096];
+            if (getcwd(directory, sizeof(directory)) == nullptr) {
+                throw CompileError("Unable to determine the working directory");
+            }
+            std::vector<std::string> request {directory};
+            request.insert(request.end(), args.begin(), args.end());
+            return exchange(request);
+        }
+
+        void stop() const {
+            exchange({"stop"});
+        }
+
+    private:
+        Response exchange(const std::vector<std::string>& request) const {
+            int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                throw CompileError(std::string("Unable to create socket: ") + std::strerror(errno));
+            }
+            CompileConnection connection(fd);
+            sockaddr_un address = serverAddress(socketPath);
+            if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+                throw CompileError("No compile server on " + socketPath + " (start one with helium --server)");
+            }
+            connection.send(request);
+            std::optional<std::vector<std::string>> response = connection.receive();
+            if (!response.has_value() || response->size() != 3) {
+                throw CompileError("Malformed compile server response");
+            }
+            return {.status = std::atoi(response->at(0).c_str()), .output = response->at(1), .diagnostics = response->at(2)};
+        }
+
+        std::string socketPath;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Diagnostics.cpp"
+
+// Read-only view of a source file. Regular files are memory mapped so the tokenizer reads the page
+// cache directly; pipes, empty files and anything mmap rejects are read into an owned string instead.
+class SourceBuffer {
+    public:
+        inline explicit SourceBuffer(std::string contents): owned(std::move(contents)) {
+            data = owned.data();
+            size = owned.size();
+        }
+
+        static SourceBuffer open(const std::string& path) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw CompileError("Unable to open " + path);
+            }
+            struct stat info {};
+            if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+                void* mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED) {
+                    close(fd);
+                    madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                    return SourceBuffer(static_cast<const char*>(mapped), info.st_size);
+                }
+            }
+            std::string contents;
+            char chunk[64 * 1024];
+            ssize_t count;
+            while ((count = read(fd, chunk, sizeof(chunk))) > 0) {
+                contents.append(chunk, count);
+            }
+            close(fd);
+            if (count < 0) {
+                throw CompileError("Unable to read " + path);
+            }
+            return SourceBuffer(std::move(contents));
+        }
+
+        [[nodiscard]] inline std::string_view view() const {
+            return {data, size};
+        }
+
+        [[nodiscard]] inline bool isMapped() const {
+            return mapped;
+        }
+
+        inline SourceBuffer(SourceBuffer&& other) noexcept: owned(std::move(other.owned)), mapped(other.mapped) {
+            data = mapped ? other.data : owned.data();
+            size = other.size;
+            other.mapped = false;
+            other.data = nullptr;
+            other.size = 0;
+        }
+
+        SourceBuffer(const SourceBuffer& other) = delete;
+
+        SourceBuffer& operator=(const SourceBuffer& other) = delete;
+
+        SourceBuffer& operator=(SourceBuffer&& other) = delete;
+
+        inline ~SourceBuffer() {
+            if (mapped) {
+                munmap(const_cast<char*>(data), size);
+            }
+        }
+
+    private:
+        inline SourceBuffer(const char* mappedData, size_t mappedSize): data(mappedData), size(mappedSize), mapped(true) {
+        }
+
+        std::string owned;
+        const char* data = nullptr;
+        size_t size = 0;
+        bool mapped = false;
+};
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Diagnostics.cpp"
+#include "Elf.cpp"
+#include "Encoding.cpp"
+#include "MachineCode.cpp"
+#include "Parser.cpp"
+#include "Peephole.cpp"
+#include "Selection.cpp"
+#include "Symbols.cpp"
+#include "Tokenization.cpp"
+
+// Reads a source a chunk at a time and hands it out a statement at a time. ';' only ever ends a
+// statement, so the source is split at each one without lexing it first. The buffer holds one
+// chunk plus the statement straddling it, and only grows for a statement longer than a chunk.
+class StatementReader {
+    public:
+        inline explicit StatementReader(int pFd): fd(pFd), buffer(chunkSize) {
+        }
+
+        // The next statement up to and including its ';', then whatever follows the last ';'. Empty
+        // at the end of the input. The text is valid until the next call.
+        std::optional<std::string_view> next() {
+            while (true) {
+                if (const void* semi = std::memchr(buffer.data() + scanned, ';', end - scanned)) {
+                    size_t stop = static_cast<const char*>(semi) - buffer.data() + 1;
+                    std::string_view statement(buffer.data() + start, stop - start);
+                    start = scanned = stop;
+                    return statement;
+                }
+                scanned = end;
+                if (finished) {
+                    if (start == end) {
+                        return {};
+                    }
+                    std::string_view rest(buffer.data() + start, end - start);
+                    start = end;
+                    return rest;
+                }
+                fill();
+            }
+        }
+
+    private:
+        static constexpr size_t chunkSize = 1024 * 1024;
+
+        // Moves the unfinished statement to the front and reads after it.
+        void fill() {
+            std::memmove(buffer.data(), buffer.data() + start, end - start);
+            end -= start;
+            scanned -= start;
+            start = 0;
+            if (end == buffer.size()) {
+                buffer.resize(buffer.size() * 2);
+            }
+            ssize_t count;
+            do {
+                count = read(fd, buffer.data() + end, buffer.size() - end);
+            } while (count < 0 && errno == EINTR);
+            if (count < 0) {
+                throw CompileError("Unable to read source");
+            }
+            finished = count == 0;
+            end += count;
+        }
+
+        int fd;
+        std::vector<char> buffer;
+        size_t start = 0;
+        size_t scanned = 0;
+        size_t end = 0;
+        bool finished = false;
+};
+
+// Output file written as the compile goes. It is removed again unless commit() is reached, so a
+// failed compile leaves nothing behind.
+class StreamOutput {
+    public:
+        inline StreamOutput(std::string pPath, mode_t mode): path(std::move(pPath)) {
+            fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, mode);
+            if (fd < 0) {
+                throw CompileError("Unable to write " + path);
+            }
+        }
+
+        StreamOutput(const StreamOutput& other) = delete;
+
+        StreamOutput& operator=(const StreamOutput& other) = delete;
+
+        inline ~StreamOutput() {
+            if (fd >= 0) {
+                close(fd);
+                unlink(path.c_str());
+            }
+        }
+
+        void append(const void* data, size_t size) {
+            writeAll(data, size);
+            written += size;
+        }
+
+        // Overwrites bytes already appended, such as headers reserved at the start.
+        void patch(uint64_t offset, const void* data, size_t size) {
+            if (pwrite(fd, data, size, static_cast<off_t>(offset)) != static_cast<ssize_t>(size)) {
+                throw CompileError("Unable to write " + path);
+            }
+        }
+
+        void commit() {
+            if (close(fd) != 0) {
+                fd = -1;
+                unlink(path.c_str());
+                throw CompileError("Unable to write " + path);
+            }
+            fd = -1;
+        }
+
+        [[nodiscard]] uint64_t size() const {
+            return written;
+        }
+
+    private:
+        void writeAll(const void* data, size_t size) {
+            auto* p = static_cast<const char*>(data);
+            while (size > 0) {
+                ssize_t count = write(fd, p, size);
+                if (count < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (count <= 0) {
+                    throw CompileError("Unable to write " + path);
+                }
+                p += count;
+                size -= count;
+            }
+        }
+
+        std::string path;
+        int fd = -1;
+        uint64_t written = 0;
+};
+
+// Compiles a source in one pass with memory bounded by its longest statement rather than its size.
+// Each statement is lexed, parsed, checked, generated and written out before the next is read, and
+// all of it is dropped afterwards; only the interned names and one record per variable remain.
+// Variables live in a zeroed data area addressed from r15 instead of registers, since nothing is
+// known about the statements still to come. At -O1 literal arithmetic is folded and variables
+// holding a constant are substituted rather than stored. Statements are reported in source order,
+// so an error in a later statement's syntax only shows once everything before it has checked out.
+class StreamingCompiler {
+    public:
+        inline StreamingCompiler(const std::string& os, std::string pEmit, int optimizationLevel, PeepholeOptions pPeephole):
+            emit(std::move(pEmit)), fold(optimizationLevel >= 1), runPeephole(pPeephole.runsAt(optimizationLevel)), peephole(pPeephole) {
+            // The same entry points and exit calls as the Generator.
+            if (os == "MacOS") {
+                statement.entryName.assign("_main");
+                exitCall = 0x2000000 + 1;
+            } else if (os == "Linux") {
+                statement.entryName.assign("_start");
+                exitCall = 60;
+            } else {
+                statement.entryName.assign("_start");
+                exitCall = 1;
+            }
+        }
+
+        // Compiles the source read from `input` into `outputPath`: an ELF executable with emit
+        // "exe", NASM source with emit "asm".
+        void compile(int input, const std::string& outputPath, uint8_t osAbi) {
+            StreamOutput output(outputPath, emit == "exe" ? 0755 : 0644);
+            if (emit == "exe") {
+                // Reserved for the headers, which depend on the final code and data sizes.
+                std::vector<uint8_t> headers(ElfWriter::headersSize(2));
+                output.append(headers.data(), headers.size());
+                add(MOp::mov, {MOperand::ofReg(variablesBase), MOperand::ofImm(ElfWriter::dataAddress)});
+            } else {
+                text.append("global ").append(statement.entryName).append("\n");
+                text.append(statement.entryName).append(":\n");
+                text.append("    lea ").append(regName(variablesBase)).append(", [rel variables]\n");
+            }
+
+            StatementReader reader(input);
+            while (std::optional<std::string_view> source = reader.next()) {
+                try {
+                    compileStatement(source.value());
+                } catch (const SourceError& failure) {
+                    // Positions within the statement, made positions within the whole source.
+                    throw SourceError(line + failure.line - 1, failure.line == 1 ? column + failure.column - 1 : failure.column, failure.detail);
+                }
+                advancePosition(source.value());
+                flushStatement(output, false);
+            }
+            // Falling off the end exits with 0, as the lowered program does.
+            generateExit(MOperand::ofImm(0));
+            flushStatement(output, true);
+
+            uint64_t variableBytes = std::max<uint64_t>(slotCount, 1) * 8;
+            if (emit == "exe") {
+                uint8_t headers[ElfWriter::headersSize(2)];
+                ElfWriter::writeHeaders(headers, output.size(), osAbi, variableBytes);
+                output.patch(0, headers, sizeof(headers));
+            } else {
+                std::string data = "section .bss\nvariables: resq " + std::to_string(variableBytes / 8) + "\n";
+                output.append(data.data(), data.size());
+            }
+            output.commit();
+            codeBytes = output.size();
+        }
+
+        [[nodiscard]] uint64_t statementCount() const {
+            return statements;
+        }
+
+        [[nodiscard]] uint64_t variableCount() const {
+            return slotCount;
+        }
+
+        [[nodiscard]] uint64_t outputBytes() const {
+            return codeBytes;
+        }
+
+        // Instructions written, after the peephole pass, and how many of them are a push or pop.
+        [[nodiscard]] uint64_t instructionCount() const {
+            return instructions;
+        }
+
+        [[nodiscard]] uint64_t pushPopCount() const {
+            return pushPops;
+        }
+
+        [[nodiscard]] const PeepholeOptimizer::Stats& peepholeStatistics() const {
+            return peephole.statistics();
+        }
+
+    private:
+        // A variable's slot in the data area, or its value when it is a folded constant.
+        struct Variable {
+            static constexpr uint32_t constant = UINT32_MAX;
+
+            uint32_t slot = constant;
+            uint64_t value = 0;
+        };
+
+        static constexpr Reg variablesBase = Reg::r15;
+        // r11 is the selector's spare and the register for memory to memory moves.
+        static constexpr Reg scratch = Reg::r11;
+        // Registers for intermediate results by expression depth. Going by register need, sums of
+        // products never get past the second.
+        static constexpr Reg registers[] = {Reg::rax, Reg::rcx, Reg::rdx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9, Reg::r10};
+        static constexpr size_t registerCount = sizeof(registers) / sizeof(registers[0]);
+        // Buffered output is written once it passes this many bytes.
+        static constexpr size_t flushThreshold = 1024 * 1024;
+        // Slots are addressed by a 32 bit displacement.
+        static constexpr uint32_t maxSlots = INT32_MAX / 8;
+
+        // Moves the line and column past `source`.
+        void advancePosition(std::string_view source) {
+            size_t lastNewline = source.rfind('\n');
+            if (lastNewline == std::string_view::npos) {
+                column += source.size();
+                return;
+            }
+            line += std::count(source.begin(), source.end(), '\n');
+            column = source.size() - lastNewline;
+        }
+
+        void compileStatement(std::string_view source) {
+            Tokenizer tokenizer(source, interner);
+            Parser parser(tokenizer.tokenize(), source);
+            NodeProgram program = parser.parseProgram().value();
+            // Registers each subtree needs, with leaves used in place. Children come before their
+            // parents, so one pass in node order sees both operands first.
+            needs.assign(program.nodeCount(), 0);
+            for (NodeIndex node = 0; node < program.nodeCount(); ++node) {
+                if (NodeProgram::isBinary(program.kinds[node])) {
+                    uint32_t lhs = needs[program.lhs[node]];
+                    uint32_t rhs = needs[program.rhs[node]];
+                    needs[node] = lhs == rhs ? lhs + 1 : std::max(lhs, rhs);
+                }
+            }
+            for (NodeIndex stmt: program.stmts) {
+                generateStmt(program, stmt);
+                statements++;
+            }
+        }
+
+        void generateStmt(const NodeProgram& program, NodeIndex stmt) {
+            NodeIndex expr = program.lhs[stmt];
+            checkDeclared(program, expr);
+            if (program.kinds[stmt] == NodeKind::stmt_exit) {
+                generateExit(generateExpr(program, expr, 0));
+                return;
+            }
+            MOperand value = generateExpr(program, expr, 0);
+            if (variables.find(program.symbol(stmt)) != nullptr) {
+                throw CompileError("Identifier already used!" + std::string(program.text(stmt)));
+            }
+            Variable variable;
+            if (fold && value.kind == OperandKind::imm) {
+                variable.value = value.imm;
+            } else {
+                if (slotCount == maxSlots) {
+                    throw CompileError("Too many variables to stream");
+                }
+                variable.slot = slotCount++;
+                store(slotOperand(variable.slot), value);
+            }
+            variables.declare(program.symbol(stmt), variable);
+        }
+
+        // Reports the first undeclared identifier in evaluation order before any code is generated,
+        // which may visit the operands the other way round.
+        void checkDeclared(const NodeProgram& program, NodeIndex expr) {
+            if (program.kinds[expr] == NodeKind::ident && variables.find(program.symbol(expr)) == nullptr) {
+                throw CompileError("Undeclared identifier: " + std::string(program.text(expr)));
+            }
+            if (NodeProgram::isBinary(program.kinds[expr])) {
+                checkDeclared(program, program.lhs[expr]);
+                checkDeclared(program, program.rhs[expr]);
+            }
+        }
+
+        // Leaves the value of `expr` in an operand: an immediate of any width, a variable's slot or
+        // the register for `depth`.
+        MOperand generateExpr(const NodeProgram& program, NodeIndex expr, size_t depth) {
+            NodeKind kind = program.kinds[expr];
+            if (kind == NodeKind::int_lit) {
+                return MOperand::ofImm(program.literalValue(expr));
+            }
+            if (kind == NodeKind::ident) {
+                const Variable& variable = *variables.find(program.symbol(expr));
+                return variable.slot == Variable::constant ? MOperand::ofImm(variable.value) : slotOperand(variable.slot);
+            }
+
+            // Both operations commute, so the operand needing more registers goes first, which keeps
+            // the long right-leaning chains the parser builds at two registers.
+            NodeIndex first = program.lhs[expr];
+            NodeIndex second = program.rhs[expr];
+            if (needs[second] > needs[first]) {
+                std::swap(first, second);
+            }
+            if (depth == registerCount) {
+                throw CompileError("Expression too complex to stream");
+            }
+            Reg target = registers[depth];
+            MOperand lhs = generateExpr(program, first, depth);
+            MOperand rhs = generateExpr(program, second, depth + 1);
+
+            if (fold && lhs.kind == OperandKind::imm && rhs.kind == OperandKind::imm) {
+                return MOperand::ofImm(kind == NodeKind::add ? lhs.imm + rhs.imm : lhs.imm * rhs.imm);
+            }
+            if (lhs.kind == OperandKind::imm && rhs.kind != OperandKind::imm) {
+                std::swap(lhs, rhs);
+            }
+            if (isWide(lhs)) {
+                add(MOp::mov, {MOperand::ofReg(target), lhs});
+                lhs = MOperand::ofReg(target);
+            }
+            if (isWide(rhs)) {
+                add(MOp::mov, {MOperand::ofReg(scratch), rhs});
+                rhs = MOperand::ofReg(scratch);
+            }
+            MOperand dest = MOperand::ofReg(target);
+            if (kind == NodeKind::mul && rhs.kind == OperandKind::imm) {
+                addAll(selector.selectMultiply(target, lhs, rhs.imm));
+            } else if (kind == NodeKind::add && rhs != MOperand::ofReg(scratch)) {
+                InstructionSelector::Sum sum;
+                sum.base = lhs;
+                if (rhs.kind == OperandKind::imm) {
+                    sum.disp = static_cast<int32_t>(rhs.imm);
+                } else {
+                    sum.index = rhs;
+                    sum.scale = 1;
+                }
+                addAll(selector.selectSum(target, sum));
+            } else {
+                if (lhs != dest) {
+                    add(MOp::mov, {dest, lhs});
+                }
+                add(kind == NodeKind::add ? MOp::add : MOp::imul, {dest, rhs});
+            }
+            return dest;
+        }
+
+        void generateExit(const MOperand& value) {
+            add(MOp::mov, {MOperand::ofReg(Reg::rdi), value});
+            add(MOp::mov, {MOperand::ofReg(Reg::rax), MOperand::ofImm(exitCall)});
+            add(MOp::syscall, {});
+        }
+
+        // Memory destinations cannot take another memory operand or a 64 bit immediate directly.
+        void store(const MOperand& dest, const MOperand& value) {
+            if (value.kind == OperandKind::mem || isWide(value)) {
+                add(MOp::mov, {MOperand::ofReg(scratch), value});
+                add(MOp::mov, {dest, MOperand::ofReg(scratch)});
+            } else {
+                add(MOp::mov, {dest, value});
+            }
+        }
+
+        // Runs the peephole pass over the statement's instructions, encodes or renders them and
+        // writes the buffer out once it is large enough, or at the end.
+        void flushStatement(StreamOutput& output, bool last) {
+            if (runPeephole) {
+                peephole.optimizeProgram(statement);
+            }
+            instructions += statement.insts.size();
+            for (const MInst& inst: statement.insts) {
+                pushPops += inst.op == MOp::push || inst.op == MOp::pop;
+            }
+            if (emit == "exe") {
+                for (const MInst& inst: statement.insts) {
+                    encoder.encodeInst(inst);
+                }
+                const std::vector<uint8_t>& code = encoder.pendingCode();
+                if (last || code.size() >= flushThreshold) {
+                    output.append(code.data(), code.size());
+                    encoder.clearPendingCode();
+                }
+            } else {
+                AsmWriter(statement).renderInsts(text);
+                if (last || text.size() >= flushThreshold) {
+                    output.append(text.data(), text.size());
+                    text.clear();
+                }
+            }
+            statement.insts.clear();
+        }
+
+        [[nodiscard]] static bool isWide(const MOperand& operand) {
+            return operand.kind == OperandKind::imm && operand.imm > INT32_MAX;
+        }
+
+        [[nodiscard]] static MOperand slotOperand(uint32_t slot) {
+            return MOperand::ofMem(variablesBase, static_cast<int32_t>(slot * 8));
+        }
+
+        void add(MOp op, std::initializer_list<MOperand> operands) {
+            statement.insts.push_back(MInst::make(op, operands));
+        }
+
+        void addAll(const InstructionSelector::Sequence& sequence) {
+            statement.insts.insert(statement.insts.end(), sequence.begin(), sequence.end());
+        }
+
+        std::string emit;
+        bool fold;
+        bool runPeephole;
+        PeepholeOptimizer peephole;
+        uint64_t exitCall = 0;
+        Interner interner;
+        SymbolTable<Variable> variables;
+        uint32_t slotCount = 0;
+        uint64_t statements = 0;
+        // Where the next statement starts in the whole source.
+        size_t line = 1;
+        size_t column = 1;
+        uint64_t codeBytes = 0;
+        uint64_t instructions = 0;
+        uint64_t pushPops = 0;
+        // The instructions of the statement being generated and the registers its subtrees need.
+        MachineProgram statement;
+        std::vector<uint32_t> needs;
+        InstructionSelector selector {scratch};
+        X86Encoder encoder;
+        std::string text;
+};
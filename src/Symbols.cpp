@@ -0,0 +1,211 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "Arena.cpp"
+
+using SymbolId = uint32_t;
+
+inline constexpr SymbolId noSymbol = UINT32_MAX;
+
+// Maps identifier text to dense symbol IDs, handed out from zero in order of first appearance.
+// The interner keeps its own copy of every name, so one interner can outlive the sources it saw
+// and be shared by the tokenizers of several files. It is not thread safe.
+class Interner {
+    public:
+        inline Interner(): storage(std::make_unique<ArenaAllocator>(4096)), slots(16, noSymbol) {
+        }
+
+        SymbolId intern(std::string_view name) {
+            return intern(name, hashOf(name));
+        }
+
+        // Interns a name whose hash another interner already computed.
+        SymbolId intern(std::string_view name, uint32_t hash) {
+            size_t mask = slots.size() - 1;
+            for (size_t slot = hash & mask;; slot = (slot + 1) & mask) {
+                SymbolId symbol = slots[slot];
+                if (symbol == noSymbol) {
+                    symbol = static_cast<SymbolId>(names.size());
+                    auto* copy = static_cast<char*>(storage->allocBytes(name.size(), 1));
+                    std::memcpy(copy, name.data(), name.size());
+                    names.emplace_back(copy, name.size());
+                    hashes.push_back(hash);
+                    slots[slot] = symbol;
+                    if (names.size() * 2 > slots.size()) {
+                        rehash(slots.size() * 2);
+                    }
+                    return symbol;
+                }
+                if (hashes[symbol] == hash && names[symbol] == name) {
+                    return symbol;
+                }
+            }
+        }
+
+        [[nodiscard]] std::string_view name(SymbolId symbol) const {
+            return names[symbol];
+        }
+
+        [[nodiscard]] uint32_t hash(SymbolId symbol) const {
+            return hashes[symbol];
+        }
+
+        // Makes room for `count` names in all, so interning up to that many never rehashes.
+        void reserve(size_t count) {
+            names.reserve(count);
+            hashes.reserve(count);
+            size_t capacity = slots.size();
+            while (count * 2 > capacity) {
+                capacity *= 2;
+            }
+            if (capacity != slots.size()) {
+                rehash(capacity);
+            }
+        }
+
+        [[nodiscard]] size_t size() const {
+            return names.size();
+        }
+
+    private:
+        // FNV-1a; identifiers are short, so a byte loop beats anything wider.
+        static uint32_t hashOf(std::string_view name) {
+            uint32_t hash = 2166136261u;
+            for (char c: name) {
+                hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+            }
+            return hash;
+        }
+
+        void rehash(size_t capacity) {
+            slots.assign(capacity, noSymbol);
+            size_t mask = slots.size() - 1;
+            for (SymbolId symbol = 0; symbol < names.size(); ++symbol) {
+                size_t slot = hashes[symbol] & mask;
+                while (slots[slot] != noSymbol) {
+                    slot = (slot + 1) & mask;
+                }
+                slots[slot] = symbol;
+            }
+        }
+
+        std::unique_ptr<ArenaAllocator> storage;
+        std::vector<std::string_view> names;
+        std::vector<uint32_t> hashes;
+        // Open addressing with linear probing, at most half full.
+        std::vector<SymbolId> slots;
+};
+
+// Binds symbol IDs to values in nested scopes. Lookups hash the 32 bit ID into an open addressing
+// table, never the name. A declaration in an inner scope shadows the outer one until popScope().
+template<typename Value> class SymbolTable {
+    public:
+        // `expectedSymbols` sizes the table up front; it grows past that when needed.
+        inline explicit SymbolTable(size_t expectedSymbols = 0) {
+            size_t capacity = 16;
+            while (capacity < expectedSymbols * 2) {
+                capacity *= 2;
+            }
+            slots.assign(capacity, noEntry);
+            shift = 32 - static_cast<unsigned>(__builtin_ctzll(capacity));
+        }
+
+        // Binds `symbol` in the innermost scope. Returns false, changing nothing, when the innermost
+        // scope already has it.
+        bool declare(SymbolId symbol, Value value) {
+            size_t slot = slotOf(symbol);
+            uint32_t previous = slots[slot];
+            if (previous != noEntry && entries[previous].depth == depth()) {
+                return false;
+            }
+            if (previous == noEntry) {
+                occupied++;
+            }
+            slots[slot] = static_cast<uint32_t>(entries.size());
+            entries.push_back({.symbol = symbol, .depth = depth(), .shadowed = previous, .value = std::move(value)});
+            if (occupied * 2 > slots.size()) {
+                grow();
+            }
+            return true;
+        }
+
+        [[nodiscard]] Value* find(SymbolId symbol) {
+            uint32_t entry = slots[slotOf(symbol)];
+            return entry == noEntry ? nullptr : &entries[entry].value;
+        }
+
+        [[nodiscard]] const Value* find(SymbolId symbol) const {
+            uint32_t entry = slots[slotOf(symbol)];
+            return entry == noEntry ? nullptr : &entries[entry].value;
+        }
+
+        void pushScope() {
+            scopeStarts.push_back(entries.size());
+        }
+
+        // Drops every declaration of the innermost scope, bringing back what they shadowed.
+        void popScope() {
+            size_t start = scopeStarts.back();
+            scopeStarts.pop_back();
+            while (entries.size() > start) {
+                const Entry& entry = entries.back();
+                // Emptying a slot needs no tombstone: every symbol that probed past it was first
+                // declared later and is already gone.
+                slots[slotOf(entry.symbol)] = entry.shadowed;
+                if (entry.shadowed == noEntry) {
+                    occupied--;
+                }
+                entries.pop_back();
+            }
+        }
+
+        // Declarations in all open scopes, shadowed ones included.
+        [[nodiscard]] size_t size() const {
+            return entries.size();
+        }
+
+    private:
+        static constexpr uint32_t noEntry = UINT32_MAX;
+
+        struct Entry {
+            SymbolId symbol;
+            uint32_t depth;
+            // Entry of the same symbol in an outer scope, or noEntry.
+            uint32_t shadowed;
+            Value value;
+        };
+
+        [[nodiscard]] uint32_t depth() const {
+            return static_cast<uint32_t>(scopeStarts.size());
+        }
+
+        // Slot holding `symbol`'s innermost entry, or the empty slot where it would go. Fibonacci
+        // hashing spreads the dense IDs over the table.
+        [[nodiscard]] size_t slotOf(SymbolId symbol) const {
+            size_t mask = slots.size() - 1;
+            size_t slot = (symbol * 2654435769u) >> shift;
+            while (slots[slot] != noEntry && entries[slots[slot]].symbol != symbol) {
+                slot = (slot + 1) & mask;
+            }
+            return slot;
+        }
+
+        // Reinserts in declaration order, so popScope() can keep clearing slots without tombstones.
+        void grow() {
+            slots.assign(slots.size() * 2, noEntry);
+            shift--;
+            for (uint32_t entry = 0; entry < entries.size(); ++entry) {
+                slots[slotOf(entries[entry].symbol)] = entry;
+            }
+        }
+
+        std::vector<Entry> entries;
+        std::vector<uint32_t> slots;
+        std::vector<size_t> scopeStarts;
+        size_t occupied = 0;
+        unsigned shift;
+};
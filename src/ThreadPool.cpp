@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool. Every worker has its own queue: tasks submitted from a worker go to
+// the back of its queue and it takes its own work from the back, while idle workers steal from the
+// front of the others. Tasks must not throw.
+class ThreadPool {
+    public:
+        static constexpr size_t noWorker = SIZE_MAX;
+
+        inline explicit ThreadPool(size_t threadCount = std::thread::hardware_concurrency()) {
+            threadCount = std::max<size_t>(threadCount, 1);
+            for (size_t i = 0; i < threadCount; ++i) {
+                queues.push_back(std::make_unique<Queue>());
+            }
+            for (size_t i = 0; i < threadCount; ++i) {
+                threads.emplace_back([this, i] { workerLoop(i); });
+            }
+        }
+
+        ThreadPool(const ThreadPool& other) = delete;
+
+        ThreadPool& operator=(const ThreadPool& other) = delete;
+
+        inline ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(stateMutex);
+                stopping = true;
+            }
+            workAvailable.notify_all();
+            for (std::thread& thread: threads) {
+                thread.join();
+            }
+        }
+
+        // Queues a task on the calling worker, or round robin when called from outside the pool.
+        void submit(std::function<void()> task) {
+            size_t worker = currentWorker();
+            if (worker == noWorker || worker >= queues.size()) {
+                worker = nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+            }
+            pending.fetch_add(1, std::memory_order_relaxed);
+            {
+                std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+                queues[worker]->tasks.push_back(std::move(task));
+                queued.fetch_add(1, std::memory_order_release);
+            }
+            // Taking the lock orders this with a worker that is about to check `queued` and sleep.
+            { std::lock_guard<std::mutex> lock(stateMutex); }
+            workAvailable.notify_one();
+        }
+
+        // Blocks until every submitted task has finished.
+        void wait() {
+            std::unique_lock<std::mutex> lock(stateMutex);
+            allDone.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+        }
+
+        [[nodiscard]] size_t size() const {
+            return threads.size();
+        }
+
+        // Index of the pool worker running the caller, or noWorker outside any pool.
+        [[nodiscard]] static size_t currentWorker() {
+            return workerIndex;
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        void workerLoop(size_t index) {
+            workerIndex = index;
+            while (true) {
+                std::function<void()> task;
+                if (takeTask(index, task)) {
+                    task();
+                    if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        std::lock_guard<std::mutex> lock(stateMutex);
+                        allDone.notify_all();
+                    }
+                    continue;
+                }
+                std::unique_lock<std::mutex> lock(stateMutex);
+                workAvailable.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+                if (stopping && queued.load(std::memory_order_acquire) == 0) {
+                    return;
+                }
+            }
+        }
+
+        // Own queue first, newest task first; then the oldest task of each other worker in turn.
+        bool takeTask(size_t index, std::function<void()>& task) {
+            for (size_t offset = 0; offset < queues.size(); ++offset) {
+                Queue& queue = *queues[(index + offset) % queues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.tasks.empty()) {
+                    continue;
+                }
+                if (offset == 0) {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                } else {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                }
+                queued.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        static inline thread_local size_t workerIndex = noWorker;
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> threads;
+        std::mutex stateMutex;
+        std::condition_variable workAvailable;
+        std::condition_variable allDone;
+        std::atomic<size_t> queued = 0;
+        std::atomic<size_t> pending = 0;
+        std::atomic<size_t> nextQueue = 0;
+        bool stopping = false;
+};
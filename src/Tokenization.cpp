@@ -1,8 +1,20 @@
 #pragma once
 
 
+#include <algorithm>
+#include <array>
+#include <exception>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
+#include "Diagnostics.cpp"
+#include "Scanning.cpp"
+#include "Symbols.cpp"
+#include "ThreadPool.cpp"
 
 enum class TokenType {
     exit,
@@ -17,7 +29,7 @@ enum class TokenType {
     star
 };
 
-bool isBinaryOperator(TokenType type) {
+constexpr bool isBinaryOperator(TokenType type) {
     switch (type) {
         case TokenType::plus:
         case TokenType::star:
@@ -27,7 +39,7 @@ bool isBinaryOperator(TokenType type) {
     }
 }
 
-std::optional<int> binaryPrecedence(TokenType type) {
+constexpr std::optional<int> binaryPrecedence(TokenType type) {
     switch (type) {
         case TokenType::plus:
             return 0;
@@ -38,101 +50,214 @@ std::optional<int> binaryPrecedence(TokenType type) {
     }
 }
 
+// A token is a kind plus the span of source text it covers; the text itself stays in the source buffer.
+// Identifiers also carry their interned symbol.
 struct Token {
     TokenType type;
-    std::optional<std::string> value {};
+    uint32_t offset;
+    uint32_t length;
+    SymbolId symbol = noSymbol;
+
+    [[nodiscard]] constexpr std::string_view text(std::string_view source) const {
+        return source.substr(offset, length);
+    }
 };
 
+static_assert(std::is_trivially_copyable_v<Token>);
+
+// Token produced by each single-character punctuator, indexed by the character. Only entries
+// whose class is scan::punct are meaningful.
+constexpr std::array<TokenType, 256> makePunctuationTable() {
+    std::array<TokenType, 256> table {};
+    table['('] = TokenType::open_paren;
+    table[')'] = TokenType::close_paren;
+    table[';'] = TokenType::semi;
+    table['+'] = TokenType::plus;
+    table['*'] = TokenType::star;
+    table['='] = TokenType::eq;
+    return table;
+}
+
+inline constexpr std::array<TokenType, 256> punctuationTable = makePunctuationTable();
+
+// The printable character itself, or the byte in hex.
+inline std::string unexpectedCharacter(char c) {
+    static constexpr char hexDigits[] = "0123456789abcdef";
+    auto byte = static_cast<unsigned char>(c);
+    if (byte >= 0x20 && byte < 0x7f) {
+        return std::string("Unexpected character '") + c + "'";
+    }
+    return std::string("Unexpected byte 0x") + hexDigits[byte >> 4] + hexDigits[byte & 0xf];
+}
+
+// Lexes the token after any whitespace at `p`, a position in `source`, and moves `p` past it.
+// Returns nothing at the end of the source. Identifiers come back without a symbol; interning is up
+// to the caller. Usable in constant evaluation, where scanning falls back to the class table.
+constexpr std::optional<Token> lexToken(std::string_view source, const char*& p) {
+    const char* end = source.data() + source.size();
+    p = scan::skipSpace(p, end);
+    if (p == end) {
+        return {};
+    }
+    const char* start = p;
+    auto offset = static_cast<uint32_t>(start - source.data());
+    uint8_t charClass = scan::classOf(*p);
+    if (charClass == scan::alpha) {
+        p = scan::skipAlnum(p + 1, end);
+        std::string_view word(start, p - start);
+        TokenType type = word == "exit" ? TokenType::exit : word == "var" ? TokenType::var : TokenType::ident;
+        return Token {.type = type, .offset = offset, .length = static_cast<uint32_t>(word.size())};
+    }
+    if (charClass == scan::digit) {
+        p = scan::skipDigits(p + 1, end);
+        return Token {.type = TokenType::int_lit, .offset = offset, .length = static_cast<uint32_t>(p - start)};
+    }
+    if (charClass == scan::punct) {
+        p++;
+        return Token {.type = punctuationTable[static_cast<unsigned char>(*start)], .offset = offset, .length = 1};
+    }
+    throw SourceError::at(source, offset, unexpectedCharacter(*start));
+}
+
 class Tokenizer {
     public:
-        inline explicit Tokenizer(std::string src) : source(std::move(src)) {
+        inline explicit Tokenizer(std::string_view src) : source(src), ownedInterner(std::make_unique<Interner>()), interner(*ownedInterner) {
+            checkSize();
+        }
+
+        // Interns identifiers into `pInterner`, so symbol IDs agree across every file lexed with it.
+        inline Tokenizer(std::string_view src, Interner& pInterner) : source(src), interner(pInterner) {
+            checkSize();
         }
 
         inline std::vector<Token> tokenize() {
             std::vector<Token> tokens;
-            std::string buf;
-            while (peek().has_value()) {
-                if (std::isalpha(peek().value())) {
-                    buf.push_back(consume());
-                    while (peek() && std::isalnum(peek().value())) {
-                        buf.push_back(consume());
-                    }
-                    if (buf == "exit") {
-                        tokens.push_back({.type = TokenType::exit});
-                        buf.clear();
-                        continue;
-                    } else if (buf == "var") {
-                        tokens.push_back({.type = TokenType::var});
-                        buf.clear();
-                        continue;
-                    }
-                    else {
-                        tokens.push_back({.type = TokenType::ident, .value = buf});
-                        buf.clear();
-                        continue;
-                    }
-                } else if (std::isdigit(peek().value())) {
-                    buf.push_back(consume());
-                    while (peek().has_value() && std::isdigit(peek().value())) {
-                        buf.push_back(consume());
-                    }
-                    tokens.push_back({.type = TokenType::int_lit, .value = buf});
-                    buf.clear();
-                    continue;
-                //TODO: make this whole section here into a token string which is checked for
-                } else if (peek().value() == '(') {
-                    consume();
-                    tokens.push_back({.type = TokenType::open_paren});
-                    continue;
-                } else if (peek().value() == ')') {
-                    consume();
-                    tokens.push_back({.type = TokenType::close_paren});
-                    continue;
+            tokens.reserve(source.size() / 8);
+            const char* p = source.data();
+            while (std::optional<Token> token = lexToken(source, p)) {
+                if (token->type == TokenType::ident) {
+                    token->symbol = interner.intern(token->text(source));
                 }
-                else if (peek().value() == ';') {
-                    consume();
-                    tokens.push_back({.type = TokenType::semi});
-                    continue;
-                }
-                else if (peek().value() == '+') {
-                    consume();
-                    tokens.push_back({.type = TokenType::plus});
-                    continue;
-                } else if (peek().value() == '*') {
-                    consume();
-                    tokens.push_back({.type = TokenType::star});
-                    continue;
+                tokens.push_back(token.value());
+            }
+            return tokens;
+        }
+
+        // Lexes on `pool`, with the same result as tokenize(). The source is split after the first
+        // ';' at or past evenly spaced offsets, one piece per worker; a ';' is always a token of its
+        // own, so no token straddles a split. Each piece is lexed with an interner of its own, and
+        // their names are then interned here in source order, which hands out the IDs tokenize()
+        // would. The first error in source order is the one thrown.
+        std::vector<Token> tokenize(ThreadPool& pool) {
+            std::vector<size_t> bounds = splitPoints(pool.size());
+            if (bounds.size() < 3) {
+                return tokenize();
+            }
+            std::vector<Piece> pieces(bounds.size() - 1);
+            for (size_t i = 0; i < pieces.size(); ++i) {
+                pool.submit([this, &piece = pieces[i], begin = bounds[i], end = bounds[i + 1]] {
+                    lexPiece(piece, begin, end);
+                });
+            }
+            pool.wait();
+
+            size_t total = 0;
+            size_t names = interner.size();
+            for (Piece& piece: pieces) {
+                if (piece.failure) {
+                    std::rethrow_exception(piece.failure);
                 }
-                else if (peek().value() == '=') {
-                    consume();
-                    tokens.push_back({.type = TokenType::eq});
-                    continue;
-                } else if (isspace(peek().value())) {
-                    consume();
-                    continue;
-                } else {
-                    std::cerr << "WTF 1" << std::endl;
-                    exit(EXIT_FAILURE);
+                piece.first = total;
+                total += piece.tokens.size();
+                names += piece.interner.size();
+            }
+            // The output is allocated and initialized on a worker while the names are merged here.
+            std::vector<Token> tokens;
+            pool.submit([&tokens, total] {
+                tokens.resize(total);
+            });
+            interner.reserve(names);
+            for (Piece& piece: pieces) {
+                piece.symbols.resize(piece.interner.size());
+                for (SymbolId local = 0; local < piece.symbols.size(); ++local) {
+                    piece.symbols[local] = interner.intern(piece.interner.name(local), piece.interner.hash(local));
                 }
             }
-            index = 0;
+            pool.wait();
+            for (Piece& piece: pieces) {
+                pool.submit([&tokens, &piece] {
+                    Token* out = tokens.data() + piece.first;
+                    for (Token token: piece.tokens) {
+                        if (token.type == TokenType::ident) {
+                            token.symbol = piece.symbols[token.symbol];
+                        }
+                        *out++ = token;
+                    }
+                    piece.tokens = {};
+                });
+            }
+            pool.wait();
             return tokens;
         }
 
+        [[nodiscard]] const Interner& symbols() const {
+            return interner;
+        }
+
     private:
-        [[nodiscard]] inline std::optional<char> peek(int offset = 0) const {
-            if (index + offset >= source.length()) {
-                return {};
-            } else {
-                return source.at(index + offset);
+        // Splitting pays off only when every piece keeps a worker busy for a while.
+        static constexpr size_t minPieceBytes = 256 * 1024;
+
+        struct Piece {
+            Interner interner;
+            std::vector<Token> tokens;
+            // Global symbol of each of the piece's own.
+            std::vector<SymbolId> symbols;
+            size_t first = 0;
+            std::exception_ptr failure;
+        };
+
+        // Offsets where the pieces start, followed by the end of the source.
+        [[nodiscard]] std::vector<size_t> splitPoints(size_t pieceCount) const {
+            pieceCount = std::min(pieceCount, source.size() / minPieceBytes);
+            std::vector<size_t> bounds {0};
+            for (size_t i = 1; i < pieceCount; ++i) {
+                size_t semi = source.find(';', std::max(source.size() / pieceCount * i, bounds.back()));
+                if (semi == std::string_view::npos) {
+                    break;
+                }
+                bounds.push_back(semi + 1);
+            }
+            if (bounds.back() != source.size()) {
+                bounds.push_back(source.size());
             }
+            return bounds;
         }
 
-        char consume() {
-            return source.at(index++);
+        // Lexes [begin, end) of the source. Offsets stay relative to the whole source.
+        void lexPiece(Piece& piece, size_t begin, size_t end) {
+            try {
+                std::string_view prefix = source.substr(0, end);
+                piece.tokens.reserve((end - begin) / 8);
+                const char* p = source.data() + begin;
+                while (std::optional<Token> token = lexToken(prefix, p)) {
+                    if (token->type == TokenType::ident) {
+                        token->symbol = piece.interner.intern(token->text(prefix));
+                    }
+                    piece.tokens.push_back(token.value());
+                }
+            } catch (...) {
+                piece.failure = std::current_exception();
+            }
+        }
 
+        void checkSize() const {
+            if (source.size() > UINT32_MAX) {
+                throw CompileError("Source files larger than 4 GiB are not supported");
+            }
         }
 
-        const std::string source;
-        size_t index = 0;
-};
\ No newline at end of file
+        const std::string_view source;
+        std::unique_ptr<Interner> ownedInterner;
+        Interner& interner;
+};
@@ -0,0 +1,32 @@
+#include <cstdint>
+#include <cstdlib>
+#include "../src/Embedded.cpp"
+
+// Embedded snippets, checked while this file compiles: a snippet that stops evaluating in
+// constant expressions fails the build.
+
+// Constant snippets fold to their exit code.
+static_assert(helium::compile<"var x = 1 + 2 * 3 + 1; exit(x + 5);">() == 13);
+static_assert(helium::compile<"exit(7);">() == 7);
+// The first exit gives the result, and arithmetic wraps at 64 bits.
+static_assert(helium::compile<"exit(1); exit(2);">() == 1);
+static_assert(helium::compile<"exit(18446744073709551615 + 2);">() == 1);
+
+// Statements without an exit give 0.
+static_assert(helium::compile<"var x = 4; var y = x * x;">() == 0);
+
+// Identifiers read before a declaration are parameters, in order of first use.
+constexpr auto scaled = helium::compile<"var y = a * b; exit(y + a);">();
+static_assert(decltype(scaled)::parameterCount == 2);
+static_assert(scaled(3, 4) == 15);
+static_assert(scaled(0, 9) == 0);
+
+constexpr auto affine = helium::compile<"exit(m * x + c);">();
+static_assert(decltype(affine)::parameterCount == 3);
+static_assert(affine(2, 5, 1) == 11);
+
+int main() {
+    // Parameterized snippets run at run time as well.
+    volatile uint64_t x = 6;
+    return scaled(x, 7) == 48 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
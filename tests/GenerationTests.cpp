@@ -0,0 +1,57 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include "../src/IR.cpp"
+#include "../src/Generation.cpp"
+#include "../src/Encoding.cpp"
+#include "../src/Jit.cpp"
+
+// Generator tests: hand-built IR, generated as a JIT function and run.
+
+static int failures = 0;
+
+static void check(const char* name, IRModule& module, uint64_t expected) {
+    Generator generator(module);
+    MachineProgram program = generator.generateProgram();
+    X86Encoder encoder;
+    uint64_t result = JitFunction(encoder.encodeProgram(program)).run();
+    if (result != expected) {
+        std::fprintf(stderr, "%s: expected %llu, got %llu\n", name, static_cast<unsigned long long>(expected), static_cast<unsigned long long>(result));
+        failures++;
+    }
+}
+
+// (a + b) + c with every leaf a constant too wide for an immediate: the inner add's Sum takes both
+// terms, so c has to be added to it as a separate value.
+static void leftDeepWideSum() {
+    IRModule module;
+    IRBlock* block = module.addBlock();
+    IRInst* a = module.create(IROp::constant, nullptr, nullptr, 3000000000);
+    IRInst* b = module.create(IROp::constant, nullptr, nullptr, 3000000001);
+    IRInst* c = module.create(IROp::constant, nullptr, nullptr, 3000000002);
+    IRInst* inner = module.create(IROp::add, a, b);
+    IRInst* outer = module.create(IROp::add, inner, c);
+    block->insts = {a, b, c, inner, outer, module.create(IROp::exit, outer)};
+    check("left-deep wide sum", module, 9000000003);
+}
+
+// (a + b * 4) + c: the inner Sum is full with a scaled term.
+static void leftDeepScaledSum() {
+    IRModule module;
+    IRBlock* block = module.addBlock();
+    IRInst* a = module.create(IROp::constant, nullptr, nullptr, 3000000000);
+    IRInst* b = module.create(IROp::constant, nullptr, nullptr, 3000000001);
+    IRInst* c = module.create(IROp::constant, nullptr, nullptr, 3000000002);
+    IRInst* four = module.create(IROp::constant, nullptr, nullptr, 4);
+    IRInst* scaled = module.create(IROp::mul, b, four);
+    IRInst* inner = module.create(IROp::add, a, scaled);
+    IRInst* outer = module.create(IROp::add, inner, c);
+    block->insts = {a, b, c, four, scaled, inner, outer, module.create(IROp::exit, outer)};
+    check("left-deep scaled sum", module, 3000000000ull + 4 * 3000000001ull + 3000000002ull);
+}
+
+int main() {
+    leftDeepWideSum();
+    leftDeepScaledSum();
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,43 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "../src/Tokenization.cpp"
+
+// Tokenizer tests: lexing errors report where they happened, serially and in parallel.
+
+static int failures = 0;
+
+template<typename Lex> static void expectError(const char* name, const std::string& expected, Lex lex) {
+    std::string message = "no error";
+    try {
+        lex();
+    } catch (const CompileError& failure) {
+        message = failure.what();
+    }
+    if (message != expected) {
+        std::fprintf(stderr, "%s: expected \"%s\", got \"%s\"\n", name, expected.c_str(), message.c_str());
+        failures++;
+    }
+}
+
+int main() {
+    std::string small = "var x = 1;\n  exit(x # 2);\n";
+    expectError("unexpected character", "2:10: Unexpected character '#'", [&] {
+        Tokenizer(small).tokenize();
+    });
+    expectError("unexpected byte", "1:1: Unexpected byte 0x01", [] {
+        Tokenizer("\x01").tokenize();
+    });
+
+    // Large enough to be split into pieces; the bad character is in the last one.
+    std::string large;
+    for (int i = 0; i < 200000; ++i) {
+        large.append("var a").append(std::to_string(i)).append(" = 1;\n");
+    }
+    large.append("exit(a1 @ a2);\n");
+    ThreadPool pool(4);
+    expectError("unexpected character in a piece", "200001:9: Unexpected character '@'", [&] {
+        Tokenizer(large).tokenize(pool);
+    });
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}